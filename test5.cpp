@@ -11,14 +11,44 @@
 #include <algorithm>
 #include <string>
 #include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include <cstring>
+#include <climits>
+#include <cerrno>
 
 #if defined(_WIN32) || defined(_WIN64)
 #include <windows.h>
 #include <conio.h>
+#include <io.h>
+#include <fcntl.h>
 #else
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <csignal>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TANK_X86_SIMD 1
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #endif
 
 using namespace std;
@@ -27,8 +57,11 @@ using namespace std;
 const int WIDTH = 100;
 const int HEIGHT = 30;
 const int FRAME_MS = 40;
+const int64_t FRAME_NS = FRAME_MS * 1000000LL;
 const int START_ENEMY_RATE = 40;
 const int EXPLOSION_FRAMES = 6;
+const int ENEMY_CHUNK = 512;   // enemies per parallel AI chunk; fewer run inline
+const int SWARM_WAVES = 16;    // --swarm: spawn waves per tick, thousands of enemies on screen
 
 // ---------- Platform helpers ----------
 #if defined(_WIN32) || defined(_WIN64)
@@ -59,42 +92,118 @@ void restoreConsole() {
 }
 
 // ---------- Keyboard ----------
+thread_local const char *tlsThreadName = "game";  // threads rename themselves on start (tracing)
+thread_local bool tlsPoolThread = false;          // pool workers stay out of the frame profiler
+
+// Key presses are stamped on arrival and queued in a single-producer/
+// single-consumer ring; the game drains it at the start of each tick.
+struct KeyEvent { int key; int64_t ts; };  // ts: steady clock ns
+
+inline int64_t steadyNowNs() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+    chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct KeyRing {
+  static const uint32_t CAP = 256;
+  KeyEvent ev[CAP];
+  atomic<uint32_t> head{0}, tail{0};
+  atomic<uint32_t> dropped{0};
+  bool push(const KeyEvent &e) {
+    uint32_t h = head.load(memory_order_relaxed);
+    if (h - tail.load(memory_order_acquire) == CAP) { dropped.fetch_add(1, memory_order_relaxed); return false; }
+    ev[h % CAP] = e;
+    head.store(h + 1, memory_order_release);
+    return true;
+  }
+  bool pop(KeyEvent &e) {
+    uint32_t t = tail.load(memory_order_relaxed);
+    if (t == head.load(memory_order_acquire)) return false;
+    e = ev[t % CAP];
+    tail.store(t + 1, memory_order_release);
+    return true;
+  }
+  bool empty() const { return tail.load(memory_order_relaxed) == head.load(memory_order_acquire); }
+};
+KeyRing keyRing;
+
 void kb_init();
 void kb_restore();
 int kb_hit();
 int kb_get();
+bool kb_poll(KeyEvent &ev);
 
 #if defined(_WIN32) || defined(_WIN64)
 void kb_init() {}
 void kb_restore() {}
 int kb_hit() { return _kbhit(); }
 int kb_get() { return _getch(); }
+bool kb_poll(KeyEvent &ev) {
+  if (!_kbhit()) return false;
+  ev.key = _getch();
+  ev.ts = steadyNowNs();
+  return true;
+}
 #else
 static struct termios oldt;
+static thread inputThread;
+static int inputWake[2] = {-1, -1};  // written to stop the reader
+int inputNotifyFd = -1;              // eventfd bumped after each batch of keys (Linux)
+
+// blocks on stdin and queues every byte with its arrival time
+void inputThreadMain() {
+  tlsThreadName = "input";
+  pollfd fds[2] = { {STDIN_FILENO, POLLIN, 0}, {inputWake[0], POLLIN, 0} };
+  char buf[64];
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    if (fds[1].revents) return;
+    if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n == 0) return;  // stdin closed
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      return;
+    }
+    int64_t ts = steadyNowNs();
+    for (ssize_t i=0;i<n;i++) keyRing.push(KeyEvent{(unsigned char)buf[i], ts});
+    if (inputNotifyFd >= 0) {
+      uint64_t one = 1;
+      ssize_t w = write(inputNotifyFd, &one, sizeof(one));
+      (void)w;
+    }
+  }
+}
+
 void kb_init() {
   tcgetattr(STDIN_FILENO, &oldt);
   struct termios newt = oldt;
   newt.c_lflag &= ~(ICANON | ECHO);
   tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-  int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-  fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+#if defined(__linux__)
+  inputNotifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+  if (pipe(inputWake) == 0) inputThread = thread(inputThreadMain);
 }
 void kb_restore() {
+  if (inputThread.joinable()) {
+    char c = 0;
+    if (write(inputWake[1], &c, 1) == 1) inputThread.join();
+    else inputThread.detach();
+    close(inputWake[0]); close(inputWake[1]);
+  }
+  if (inputNotifyFd >= 0) { close(inputNotifyFd); inputNotifyFd = -1; }
   tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-  int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-  fcntl(STDIN_FILENO, F_SETFL, flags & ~O_NONBLOCK);
-}
-int kb_hit() {
-  char ch;
-  ssize_t n = read(STDIN_FILENO, &ch, 1);
-  if (n == 1) { ungetc(ch, stdin); return 1; }
-  return 0;
 }
+int kb_hit() { return !keyRing.empty(); }
 int kb_get() {
-  int c = getchar();
-  if (c == EOF) return 0;
-  return c;
+  KeyEvent ev;
+  return keyRing.pop(ev) ? ev.key : 0;
 }
+bool kb_poll(KeyEvent &ev) { return keyRing.pop(ev); }
 #endif
 
 // ---------- Colors ----------
@@ -107,12 +216,187 @@ const string COL_TEXT = fgColor(97);
 const string COL_EXP1 = fgColor(33);
 const string COL_EXP2 = fgColor(91);
 const string COL_BOSS = fgColor(35);
+const string COL_RESET = colorReset();
+
+// Arena colors are RGB, quantized once to what the terminal can show:
+// truecolor, the xterm 256-color cube and grey ramp, or the 16 ANSI colors.
+// The built-in colors are the ANSI defaults, so 16-color output keeps its
+// original codes.
+struct Rgb { uint8_t r, g, b; };
+const Rgb ANSI16[16] = {
+  {0,0,0}, {205,0,0}, {0,205,0}, {205,205,0}, {0,0,238}, {205,0,205}, {0,205,205}, {229,229,229},
+  {127,127,127}, {255,0,0}, {0,255,0}, {255,255,0}, {92,92,255}, {255,0,255}, {0,255,255}, {255,255,255} };
+enum ColorDepth { DEPTH_16, DEPTH_256, DEPTH_TRUE };
+const char *COLOR_DEPTH_NAMES[] = { "16", "256", "truecolor" };
+ColorDepth colorDepth = DEPTH_16;
+
+int rgbDist(Rgb a, Rgb b) {
+  int dr = a.r - b.r, dg = a.g - b.g, db = a.b - b.b;
+  return dr*dr*3 + dg*dg*4 + db*db*2;
+}
+
+int quantize16(Rgb c) {
+  int best = 0;
+  for (int i=1;i<16;i++) if (rgbDist(c, ANSI16[i]) < rgbDist(c, ANSI16[best])) best = i;
+  return best;
+}
+
+int quantize256(Rgb c) {
+  static const int level[6] = {0, 95, 135, 175, 215, 255};
+  auto nearest = [](int v) { int i = 0; while (i < 5 && abs(level[i+1] - v) < abs(level[i] - v)) i++; return i; };
+  int r = nearest(c.r), g = nearest(c.g), b = nearest(c.b);
+  int cube = 16 + 36*r + 6*g + b;
+  Rgb cubeRgb = { (uint8_t)level[r], (uint8_t)level[g], (uint8_t)level[b] };
+  int grey = max(0, min(23, ((c.r + c.g + c.b) / 3 - 8 + 5) / 10));
+  uint8_t gv = (uint8_t)(8 + 10*grey);
+  return rgbDist(c, Rgb{gv, gv, gv}) < rgbDist(c, cubeRgb) ? 232 + grey : cube;
+}
+
+// SGR parameters for c at colorDepth; background when bg
+string sgrColor(Rgb c, bool bg) {
+  char buf[24];
+  if (colorDepth == DEPTH_TRUE) snprintf(buf, sizeof(buf), "%d;2;%d;%d;%d", bg ? 48 : 38, c.r, c.g, c.b);
+  else if (colorDepth == DEPTH_256) snprintf(buf, sizeof(buf), "%d;5;%d", bg ? 48 : 38, quantize256(c));
+  else {
+    int i = quantize16(c);
+    snprintf(buf, sizeof(buf), "%d", (bg ? 40 : 30) + (i & 7) + (i >= 8 ? 60 : 0));
+  }
+  return buf;
+}
+
+// COLORTERM advertises truecolor, TERM names 256-color terminals
+ColorDepth detectColorDepth() {
+  const char *ct = getenv("COLORTERM");
+  if (ct && (strcmp(ct, "truecolor") == 0 || strcmp(ct, "24bit") == 0)) return DEPTH_TRUE;
+#if defined(_WIN32) || defined(_WIN64)
+  if (getenv("WT_SESSION")) return DEPTH_TRUE;
+#endif
+  const char *term = getenv("TERM");
+  if (term && strstr(term, "256color")) return DEPTH_256;
+  return DEPTH_16;
+}
+
+// Arena glyphs map to a small attribute id (0 = plain) and each id to its
+// escape, all built once so encoding never formats escapes. There is a glyph
+// table per output kind (color, mono, half-block) and per flicker phase,
+// since '*' alternates between two colors. The half-block tables stay blank:
+// packHalfBlocks() gives every cell its style as an override instead.
+enum CellAttr : uint8_t { A_PLAIN, A_RED, A_MAGENTA, A_BLUE, A_YELLOW, A_CYAN, A_WHITE, A_TEAL, A_GREY, A_DARK, A_EXP, A_COUNT };
+const int ATTR_ANSI[A_COUNT] = { 0, 9, 13, 4, 11, 14, 15, 6, 7, 8, 3 };  // index into ANSI16
+enum LutKind { LUT_COLOR, LUT_MONO, LUT_HALF, LUT_KINDS };
+const int ATTR_MAX = 255;  // 0xFF pads attribute rows for the run scanners
+uint8_t cellAttr[LUT_KINDS][2][256];
+Rgb attrRgb[ATTR_MAX];
+string attrColor[ATTR_MAX];  // SGR per attribute id
+string attrGlyph[ATTR_MAX];  // half-block cell (UTF-8) replacing the glyph; empty keeps it
+int attrCount = A_COUNT;
+bool halfBlocks = false;     // --half-block
+
+// Explosions fade from white-hot to dark red over their life when the
+// terminal has more than 16 colors; draw code sets these per cell.
+const Rgb EXP_GRADIENT[EXPLOSION_FRAMES] = {
+  {255,255,210}, {255,230,90}, {255,170,20}, {240,100,0}, {190,40,0}, {110,15,10} };
+uint8_t expGradientAttr[EXPLOSION_FRAMES];
+bool expGradient = false;
+
+// half-block pixels: which of its two pixels a glyph fills, or text for
+// glyphs that stay characters. Pixel colors are glyph colors or gradient
+// steps, so they stay below HALF_COLORS.
+enum HalfMask : uint8_t { HM_NONE = 0, HM_TOP = 1, HM_BOTTOM = 2, HM_BOTH = 3, HM_TEXT = 4 };
+const int HALF_COLORS = A_COUNT + EXPLOSION_FRAMES;
+uint8_t halfMask[256];
+uint8_t halfPair[HALF_COLORS][HALF_COLORS];  // cell style per top/bottom pixel color; two-color ones on first use
+uint8_t halfText[HALF_COLORS];               // text glyph in a pixel color
+uint8_t expBelow[ATTR_MAX];                  // gradient step burning under each explosion color
+
+// interns a plain foreground attribute
+uint8_t colorAttr(Rgb c) {
+  string sgr = "\x1B[" + sgrColor(c, false) + "m";
+  for (int a=1; a<attrCount; a++)
+    if (attrColor[a] == sgr && attrGlyph[a].empty()) return a;
+  attrRgb[attrCount] = c;
+  attrColor[attrCount] = sgr;
+  return attrCount++;
+}
+
+// Half-block mode splits each cell into a top and bottom pixel drawn with
+// ▀/▄/█ and fg/bg colors. top/bottom are color attributes, A_PLAIN = none;
+// text keeps the glyph itself in the top color. Styles are interned.
+uint8_t halfAttr(int top, int bottom, bool text) {
+  if (top == A_PLAIN && bottom == A_PLAIN) return A_PLAIN;
+  const char *glyph = text ? "" : bottom == A_PLAIN ? "\xE2\x96\x80" : top == A_PLAIN ? "\xE2\x96\x84"
+                    : top == bottom ? "\xE2\x96\x88" : "\xE2\x96\x80";
+  string sgr = "\x1B[0;" + sgrColor(attrRgb[top != A_PLAIN ? top : bottom], false);
+  if (!text && top != A_PLAIN && bottom != A_PLAIN && top != bottom) sgr += ";" + sgrColor(attrRgb[bottom], true);
+  sgr += "m";
+  for (int a=A_COUNT; a<attrCount; a++)
+    if (attrColor[a] == sgr && attrGlyph[a] == glyph) return a;
+  attrColor[attrCount] = sgr;
+  attrGlyph[attrCount] = glyph;
+  return attrCount++;
+}
+
+void initCellColors() {
+  for (int a=1; a<A_COUNT; a++) {
+    attrRgb[a] = ANSI16[ATTR_ANSI[a]];
+    attrColor[a] = "\x1B[" + sgrColor(attrRgb[a], false) + "m";
+  }
+  uint8_t *t = cellAttr[LUT_COLOR][0];
+  for (char c: {'#', 'o'}) t[(unsigned char)c] = A_RED;
+  for (char c: {'/', '\\', '_', '^', 'C'}) t[(unsigned char)c] = A_MAGENTA;
+  for (char c: {'+', '-'}) t[(unsigned char)c] = A_BLUE;
+  for (char c: {'=', '&', 'S', 'R', 'D', '!', '|'}) t[(unsigned char)c] = A_YELLOW;
+  t['Z'] = A_CYAN;
+  t[':'] = A_WHITE;
+  t['O'] = A_TEAL;
+  t['.'] = A_GREY;
+  t['`'] = A_DARK;
+  t['*'] = A_EXP;
+  copy(t, t + 256, cellAttr[LUT_COLOR][1]);
+  cellAttr[LUT_COLOR][1]['*'] = A_RED;  // COL_EXP2
+
+  expGradient = colorDepth != DEPTH_16;
+  for (int i=0; i<EXPLOSION_FRAMES; i++) expGradientAttr[i] = colorAttr(EXP_GRADIENT[i]);
+
+  // half blocks: low glyphs fill the bottom pixel, high ones and bullet dots
+  // the top, item letters and uncolored glyphs stay text; stars are drawn
+  // per pixel by packHalfBlocks, so their glyphs fill nothing
+  for (int c=1; c<256; c++) {
+    int a = t[c];
+    halfMask[c] = c == ' ' || c == '.' || c == '`' ? HM_NONE : a == A_PLAIN || strchr("=&SRD!", c) ? HM_TEXT
+                : c == '_' ? HM_BOTTOM : c == '^' || c == ':' ? HM_TOP : HM_BOTH;
+  }
+  for (int c=1; c<HALF_COLORS; c++) {
+    halfPair[c][A_PLAIN] = halfAttr(c, A_PLAIN, false);
+    halfPair[A_PLAIN][c] = halfAttr(A_PLAIN, c, false);
+    halfPair[c][c] = halfAttr(c, c, false);
+    halfText[c] = halfAttr(c, A_PLAIN, true);
+  }
+  for (int i=0; i<EXPLOSION_FRAMES; i++) expBelow[expGradientAttr[i]] = expGradientAttr[min(i+1, EXPLOSION_FRAMES-1)];
+}
+
+// ---------- Random ----------
+// The simulation draws from its own seeded generator (splitmix64), not the
+// C library one, so a game is a pure function of the seed and the inputs;
+// lockstep play depends on that.
+thread_local uint64_t rngState = 0;
+
+void seedRng(uint64_t seed) { rngState = seed; }
+
+// non-negative, 31 bits, like the C library generator
+int gameRand() {
+  uint64_t z = (rngState += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return (int)((z ^ (z >> 31)) >> 33);
+}
 
 // ---------- Entities ----------
 struct Bullet {
   int x, y, dy, dmg;
   char ch;
-  Bullet(int _x,int _y,int _dy,int _dmg,char _ch):x(_x),y(_y),dy(_dy),dmg(_dmg),ch(_ch){}
+  int owner;  // index into players
+  Bullet(int _x,int _y,int _dy,int _dmg,char _ch,int _owner=0):x(_x),y(_y),dy(_dy),dmg(_dmg),ch(_ch),owner(_owner){}
 };
 
 enum EnemyType { NORMAL, FAST, STRONG, BOUNCER, ZIGZAG, CHASER, BOSS };
@@ -128,7 +412,7 @@ struct Enemy {
     else if (_t == ZIGZAG) hp = 2;
     else if (_t == BOSS) hp = 20;
     else hp = 2; // CHASER
-    dir = (rand()%2)?1:-1;
+    dir = (gameRand()%2)?1:-1;
     skillCooldown = 0;
   }
 };
@@ -142,6 +426,9 @@ struct Tank {
   int shotDamage;
   int shotCount;
   int shieldCount;
+  int cooldown = 0;   // ticks until it may fire again
+  bool alive = true;
+  int score = 0;      // this tank's kills; the shared score drives levels
   Tank(int _x=0,int _y=0,int _hp=5,string _type="Standard",int _speed=1,int _fireRate=6,
        int _shotDamage=1,int _shotCount=1,int _shieldCount=0)
     : x(_x), y(_y), hp(_hp), type(_type), speed(_speed), fireRate(_fireRate),
@@ -180,23 +467,827 @@ struct LaserBeam {
 };
 
 // ---------- State ----------
-Tank player{WIDTH/2, HEIGHT-4, 5, "Standard", 1, 6, 1, 1, 0};
-vector<Bullet> bullets;
-vector<Enemy> enemies;
-vector<Explosion> explosions;
-vector<Item> items;
-vector<Bomb> bombs;
-LaserBeam laser;
-
-int score = 0;
-int tickCount = 0;
-int enemySpawnRate = START_ENEMY_RATE;
-int level = 1;
-bool running = true;
+// The simulated world is per thread, so batch runs on the worker pool each
+// play their own game; everything else only ever sees the main thread's.
+// players[1] only takes part in two-player games; player is the first tank
+thread_local Tank players[2] = { {WIDTH/2, HEIGHT-4, 5, "Standard", 1, 6, 1, 1, 0}, {} };
+thread_local Tank &player = players[0];
+thread_local int playerCount = 1;
+thread_local bool versus = false;  // two players: bullets hit the other tank, last one standing wins
+thread_local bool swarm = false;   // swarm difficulty: a flood of enemies every tick
+thread_local vector<Bullet> bullets;
+thread_local vector<Enemy> enemies;
+thread_local vector<Explosion> explosions;
+thread_local vector<Item> items;
+thread_local vector<Bomb> bombs;
+thread_local LaserBeam laser;
+
+thread_local int score = 0;
+thread_local int tickCount = 0;
+thread_local int enemySpawnRate = START_ENEMY_RATE;
+thread_local int level = 1;
+thread_local bool running = true;
 
 // Power-up runtime states
-int rapidFireTimer = 0;     // ticks remaining
-int damageBoostTimer = 0;   // ticks remaining
+thread_local int rapidFireTimer = 0;     // ticks remaining
+thread_local int damageBoostTimer = 0;   // ticks remaining
+atomic<long> ticksTotal{0};  // simulated ticks since start, across games (and batch runs)
+
+// Render detail, lowered automatically when the terminal link falls behind
+bool animEffects = true;    // enemy blinking, explosion phases and flicker
+bool colorOutput = true;    // per-cell color escapes
+int renderRateDivisor = 1;  // render every Nth render slot
+
+// ---------- Allocation accounting ----------
+// Every operator new is counted globally and per thread; phase scopes read
+// the per-thread counters to attribute allocations to loop phases.
+atomic<uint64_t> gAllocCount{0}, gAllocBytes{0}, gFreeCount{0};
+thread_local uint64_t tlsAllocCount = 0, tlsAllocBytes = 0;
+
+void *countedAlloc(size_t n) {
+  gAllocCount.fetch_add(1, memory_order_relaxed);
+  gAllocBytes.fetch_add(n, memory_order_relaxed);
+  tlsAllocCount++;
+  tlsAllocBytes += n;
+  return malloc(n ? n : 1);
+}
+
+void countedFree(void *p) {
+  if (!p) return;
+  gFreeCount.fetch_add(1, memory_order_relaxed);
+  free(p);
+}
+
+void *operator new(size_t n) { void *p = countedAlloc(n); if (!p) throw bad_alloc(); return p; }
+void *operator new[](size_t n) { void *p = countedAlloc(n); if (!p) throw bad_alloc(); return p; }
+void *operator new(size_t n, const nothrow_t &) noexcept { return countedAlloc(n); }
+void *operator new[](size_t n, const nothrow_t &) noexcept { return countedAlloc(n); }
+void operator delete(void *p) noexcept { countedFree(p); }
+void operator delete[](void *p) noexcept { countedFree(p); }
+void operator delete(void *p, size_t) noexcept { countedFree(p); }
+void operator delete[](void *p, size_t) noexcept { countedFree(p); }
+void operator delete(void *p, const nothrow_t &) noexcept { countedFree(p); }
+void operator delete[](void *p, const nothrow_t &) noexcept { countedFree(p); }
+
+// ---------- Output bandwidth ----------
+// Each frame write feeds a sustained-throughput and write-latency estimate.
+// When writes eat too much of the frame budget (ssh, tmux, slow terminals)
+// the detail level steps down; it steps back up after a quiet period.
+struct DetailLevel { const char *name; bool anim, color; int rateDiv; };
+const DetailLevel DETAIL_LEVELS[] = {
+  {"full", true, true, 1}, {"no-anim", false, true, 1}, {"half-rate", false, true, 2},
+  {"mono", false, false, 2}, {"quarter-rate", false, false, 4} };
+const int DETAIL_COUNT = sizeof(DETAIL_LEVELS) / sizeof(DETAIL_LEVELS[0]);
+
+bool adaptiveDetail = true;  // --no-adapt pins full detail
+int detailLevel = 0;
+double netWriteNsEwma = 0;   // time blocked in write per frame
+double netBytesPerSec = 0;   // sustained output rate over the last second
+double netLinkEstimate = 0;  // bytes/s observed while writes were blocking
+uint64_t netWinBytes = 0;
+long outFramesDropped = 0;   // queued frames replaced by newer ones (slow tty)
+int64_t netWinStart = 0, netLastChange = 0;
+
+void setDetailLevel(int lv) {
+  detailLevel = max(0, min(DETAIL_COUNT-1, lv));
+  animEffects = DETAIL_LEVELS[detailLevel].anim;
+  colorOutput = DETAIL_LEVELS[detailLevel].color;
+  renderRateDivisor = DETAIL_LEVELS[detailLevel].rateDiv;
+  netLastChange = steadyNowNs();
+}
+
+// budgetNs: render interval at the current detail level
+void outputNoteWrite(size_t bytes, int64_t writeNs, int64_t budgetNs) {
+  int64_t now = steadyNowNs();
+  netWriteNsEwma += 0.2 * (writeNs - netWriteNsEwma);
+  if (netWinStart == 0) netWinStart = now;
+  netWinBytes += bytes;
+  if (now - netWinStart >= 1000000000LL) {
+    netBytesPerSec = netWinBytes * 1e9 / (now - netWinStart);
+    netWinBytes = 0;
+    netWinStart = now;
+  }
+  if (writeNs > 1000000 && bytes > 0) {
+    double rate = bytes * 1e9 / writeNs;
+    netLinkEstimate = netLinkEstimate == 0 ? rate : netLinkEstimate + 0.2 * (rate - netLinkEstimate);
+  }
+  if (!adaptiveDetail) return;
+  double share = netWriteNsEwma / budgetNs;
+  if (share > 0.5 && detailLevel < DETAIL_COUNT-1 && now - netLastChange > 1000000000LL)
+    setDetailLevel(detailLevel + 1);
+  else if (share < 0.1 && detailLevel > 0 && now - netLastChange > 5000000000LL)
+    setDetailLevel(detailLevel - 1);
+}
+
+void appendNetOverlay(string &out) {
+  char buf[160];
+  snprintf(buf, sizeof(buf), " NET %.1f KB/s  write %.2fms  link ~%.1f KB/s  detail %s%s  dropped %ld\x1B[K\n",
+           netBytesPerSec / 1024, netWriteNsEwma / 1e6, netLinkEstimate / 1024,
+           DETAIL_LEVELS[detailLevel].name, adaptiveDetail ? "" : " (pinned)", outFramesDropped);
+  out += buf;
+}
+
+// ---------- Worker pool ----------
+// One persistent set of worker threads (--threads=N; default one per core
+// beside the main thread) shared by everything that runs in parallel:
+// headless batch runs and entity updates. Frame encoding stays serial: a
+// full redraw prepares its rows in about 3.5us, less than waking a worker.
+// Every thread that submits work owns a deque: it pushes and pops at the
+// bottom, idle workers steal from the top of someone else's (Chase-Lev), and
+// a submitter helps run tasks while it waits instead of blocking. Tasks are
+// plain structs on the submitter's stack, so dispatching allocates nothing.
+// Idle workers spin briefly, then sleep until new work is announced. Work is
+// submitted from the main thread or from inside a task; a parallel-for
+// waiting inside a task only helps with its own pieces (see poolWaitOwn).
+const int POOL_MAX_WORKERS = 16;
+const int POOL_DEQUE = 1024;        // tasks per deque, power of two; a full deque runs tasks inline
+const int POOL_FOR_CHUNKS = 64;     // most pieces a parallel-for is cut into
+const int POOL_SUCC_MAX = 8;        // task graph: most tasks one task may release
+const int POOL_SPIN = 2000;         // empty polls before an idle worker sleeps
+
+struct PoolTask {
+  void (*fn)(void *ctx, int lo, int hi) = nullptr;
+  void *ctx = nullptr;
+  int lo = 0, hi = 0;
+  atomic<int> *pending = nullptr;   // dropped by one when fn returns
+  atomic<int> deps{0};              // task graph: unfinished predecessors
+  PoolTask *succ[POOL_SUCC_MAX];
+  int succCount = 0;
+};
+
+struct PoolDeque {
+  atomic<int64_t> top{0}, bottom{0};
+  atomic<PoolTask*> slot[POOL_DEQUE];
+
+  // owner only
+  bool push(PoolTask *t) {
+    int64_t b = bottom.load(memory_order_relaxed), tp = top.load(memory_order_acquire);
+    if (b - tp >= POOL_DEQUE) return false;
+    slot[b & (POOL_DEQUE-1)].store(t, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    bottom.store(b + 1, memory_order_relaxed);
+    return true;
+  }
+
+  // owner only: newest first
+  PoolTask *pop() {
+    int64_t b = bottom.load(memory_order_relaxed) - 1;
+    bottom.store(b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = top.load(memory_order_relaxed);
+    PoolTask *x = nullptr;
+    if (t <= b) {
+      x = slot[b & (POOL_DEQUE-1)].load(memory_order_relaxed);
+      if (t == b) {  // last one: race the thieves for it
+        if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed)) x = nullptr;
+        bottom.store(b + 1, memory_order_relaxed);
+      }
+    } else {
+      bottom.store(b + 1, memory_order_relaxed);
+    }
+    return x;
+  }
+
+  // any thread: oldest first
+  PoolTask *steal() {
+    int64_t t = top.load(memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = bottom.load(memory_order_acquire);
+    if (t >= b) return nullptr;
+    PoolTask *x = slot[t & (POOL_DEQUE-1)].load(memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed)) return nullptr;
+    return x;
+  }
+};
+
+// per-thread counters; slot 0 is the main thread, 1..N the workers
+struct PoolStats {
+  atomic<int64_t> busyNs{0};
+  atomic<long> tasks{0}, steals{0};
+};
+
+int poolWorkers = 0;
+PoolDeque poolDeques[POOL_MAX_WORKERS + 1];
+PoolStats poolStats[POOL_MAX_WORKERS + 1];
+thread poolThreads[POOL_MAX_WORKERS];
+thread_local int tlsPoolSlot = 0;
+atomic<uint64_t> poolEpoch{0};      // bumped whenever work is pushed
+atomic<int> poolSleepers{0};
+atomic<bool> poolStopping{false};
+mutex poolMu;
+condition_variable poolCv;
+int64_t poolStartNs = 0;
+const char *POOL_THREAD_NAMES[POOL_MAX_WORKERS] = {
+  "worker 1", "worker 2", "worker 3", "worker 4", "worker 5", "worker 6", "worker 7", "worker 8",
+  "worker 9", "worker 10", "worker 11", "worker 12", "worker 13", "worker 14", "worker 15", "worker 16" };
+
+void poolNotify() {
+  poolEpoch.fetch_add(1);
+  if (poolSleepers.load() > 0) {
+    lock_guard<mutex> lk(poolMu);
+    poolCv.notify_all();
+  }
+}
+
+void poolRun(PoolTask *t, int self);
+
+void poolSubmit(PoolTask *t, int self) {
+  if (poolWorkers == 0 || !poolDeques[self].push(t)) { poolRun(t, self); return; }
+  poolNotify();
+}
+
+thread_local int tlsPoolDepth = 0;  // tasks running on this thread, nested ones included
+
+void poolRun(PoolTask *t, int self) {
+  int64_t t0 = steadyNowNs();
+  tlsPoolDepth++;
+  t->fn(t->ctx, t->lo, t->hi);
+  if (--tlsPoolDepth == 0)  // busy time is counted once, by the outermost task
+    poolStats[self].busyNs.fetch_add(steadyNowNs() - t0, memory_order_relaxed);
+  poolStats[self].tasks.fetch_add(1, memory_order_relaxed);
+  for (int i=0;i<t->succCount;i++)
+    if (t->succ[i]->deps.fetch_sub(1, memory_order_acq_rel) == 1) poolSubmit(t->succ[i], self);
+  if (t->pending) t->pending->fetch_sub(1, memory_order_release);
+}
+
+// own deque first, then the others starting after self
+PoolTask *poolFind(int self) {
+  if (PoolTask *t = poolDeques[self].pop()) return t;
+  for (int i=1; i<=poolWorkers; i++) {
+    int victim = (self + i) % (poolWorkers + 1);
+    if (PoolTask *t = poolDeques[victim].steal()) {
+      poolStats[self].steals.fetch_add(1, memory_order_relaxed);
+      return t;
+    }
+  }
+  return nullptr;
+}
+
+void poolWorkerMain(int self) {
+  tlsPoolSlot = self;
+  tlsPoolThread = true;
+  tlsThreadName = POOL_THREAD_NAMES[self - 1];
+  while (!poolStopping.load(memory_order_acquire)) {
+    uint64_t epoch = poolEpoch.load();
+    PoolTask *t = nullptr;
+    for (int spin=0; spin<POOL_SPIN && !t; spin++) {
+      t = poolFind(self);
+      if (!t && spin > POOL_SPIN / 2) this_thread::yield();
+    }
+    if (t) { poolRun(t, self); continue; }
+    unique_lock<mutex> lk(poolMu);
+    poolSleepers.fetch_add(1);
+    poolCv.wait(lk, [epoch]{ return poolEpoch.load() != epoch || poolStopping.load(); });
+    poolSleepers.fetch_sub(1);
+  }
+}
+
+void poolStart(int workers) {
+  poolWorkers = max(0, min(POOL_MAX_WORKERS, workers));
+  poolStartNs = steadyNowNs();
+  for (int i=0;i<poolWorkers;i++) poolThreads[i] = thread(poolWorkerMain, i + 1);
+}
+
+void poolStop() {
+  if (poolWorkers == 0) return;
+  {
+    lock_guard<mutex> lk(poolMu);
+    poolStopping.store(true);
+  }
+  poolCv.notify_all();
+  for (int i=0;i<poolWorkers;i++) poolThreads[i].join();
+  poolWorkers = 0;
+}
+
+// runs tasks (own, then stolen) until pending drops to zero; with nothing
+// to run it calls idle (which should sleep a little), or just yields
+void poolWait(atomic<int> &pending, void (*idle)() = nullptr) {
+  int self = tlsPoolSlot;
+  while (pending.load(memory_order_acquire) > 0) {
+    if (PoolTask *t = poolFind(self)) poolRun(t, self);
+    else if (idle) idle();
+    else this_thread::yield();
+  }
+}
+
+// runs the pieces of one parallel-for (those dropping pending) still in our
+// deque, then waits out the stolen ones. Nothing else is picked up: the
+// caller may be inside a task, e.g. a batch game mid-tick, and another
+// game's root run here would clobber this thread's thread_local world.
+// Our pieces sit above anything older in the deque, so the first foreign
+// task means none of ours are left.
+void poolWaitOwn(atomic<int> &pending) {
+  int self = tlsPoolSlot;
+  while (pending.load(memory_order_acquire) > 0) {
+    PoolTask *t = poolDeques[self].pop();
+    if (!t) break;
+    if (t->pending != &pending) { poolDeques[self].push(t); break; }
+    poolRun(t, self);
+  }
+  while (pending.load(memory_order_acquire) > 0) this_thread::yield();
+}
+
+// fn(ctx, lo, hi) over [0, n) in pieces of at least grain; returns once all
+// pieces are done. With no workers, or one piece, it is a plain call.
+void poolForRaw(int n, int grain, void *ctx, void (*fn)(void*, int, int)) {
+  if (n <= 0) return;
+  grain = max(grain, (n + POOL_FOR_CHUNKS - 1) / POOL_FOR_CHUNKS);
+  int pieces = (n + grain - 1) / grain;
+  if (poolWorkers == 0 || pieces == 1) { fn(ctx, 0, n); return; }
+  PoolTask tasks[POOL_FOR_CHUNKS];
+  atomic<int> pending{pieces};
+  int self = tlsPoolSlot;
+  for (int i=pieces-1; i>=0; i--) {  // thieves take the far end, we work up from the front
+    tasks[i].fn = fn;
+    tasks[i].ctx = ctx;
+    tasks[i].lo = i * grain;
+    tasks[i].hi = min(n, (i + 1) * grain);
+    tasks[i].pending = &pending;
+    if (i > 0) poolSubmit(&tasks[i], self);
+  }
+  poolRun(&tasks[0], self);
+  poolWaitOwn(pending);
+}
+
+template <class F>
+void poolFor(int n, int grain, const F &f) {
+  poolForRaw(n, grain, (void*)&f, [](void *c, int lo, int hi) { (*(const F*)c)(lo, hi); });
+}
+
+// A set of tasks with ordering edges; run() starts those with no
+// predecessors and returns when every task has finished. Each task runs
+// fn(ctx, arg, arg). run() helps with any queued task while it waits, so it
+// is only called from the top level, never from inside a task.
+struct TaskGraph {
+  vector<PoolTask> nodes;
+  int count = 0;
+  atomic<int> pending{0};
+
+  explicit TaskGraph(int capacity) : nodes(capacity) {}
+
+  int add(void (*fn)(void*, int, int), void *ctx, int arg) {
+    PoolTask &t = nodes[count];
+    t.fn = fn;
+    t.ctx = ctx;
+    t.lo = t.hi = arg;
+    t.pending = &pending;
+    return count++;
+  }
+
+  // b may only start once a has finished
+  void precede(int a, int b) {
+    PoolTask &t = nodes[a];
+    if (t.succCount == POOL_SUCC_MAX) { cerr << "task graph: too many successors\n"; abort(); }
+    t.succ[t.succCount++] = &nodes[b];
+    nodes[b].deps.fetch_add(1, memory_order_relaxed);
+  }
+
+  void run(void (*idle)() = nullptr) {
+    pending.store(count, memory_order_relaxed);
+    // find the roots before starting any: a finished task submits its own successors
+    vector<PoolTask*> roots;
+    for (int i=0;i<count;i++)
+      if (nodes[i].deps.load(memory_order_relaxed) == 0) roots.push_back(&nodes[i]);
+    int self = tlsPoolSlot;
+    for (PoolTask *t: roots) poolSubmit(t, self);
+    poolWait(pending, idle);
+  }
+};
+
+// busy share of wall time since the pool started, per thread (0 = main)
+double poolUtilization(int slot) {
+  int64_t wall = steadyNowNs() - poolStartNs;
+  return wall > 0 ? (double)poolStats[slot].busyNs.load(memory_order_relaxed) / wall : 0;
+}
+
+void dumpPool(ostream &os) {
+  if (poolWorkers == 0) return;
+  char buf[120];
+  os << "pool: " << poolWorkers << " workers\n";
+  for (int i=0;i<=poolWorkers;i++) {
+    snprintf(buf, sizeof(buf), "  %-9s %5.1f%% busy, %ld tasks, %ld stolen\n", i == 0 ? "main" : POOL_THREAD_NAMES[i-1],
+             100 * poolUtilization(i), poolStats[i].tasks.load(), poolStats[i].steals.load());
+    os << buf;
+  }
+}
+
+// ---------- Profiler ----------
+// Per-phase frame timers: a recent window for the p50/p99 overlay and a
+// log-linear histogram over the whole run for the exit dump.
+enum ProfPhase { PH_INPUT, PH_MOVE, PH_COLLIDE, PH_CLEANUP, PH_DRAW, PH_ENCODE, PH_WRITE, PH_FRAME, PH_COUNT };
+const char *PHASE_NAMES[PH_COUNT] = { "input", "move", "collide", "cleanup", "draw", "encode", "write", "frame" };
+const int PROF_WINDOW = 256;   // recent samples per phase for the overlay
+const int PROF_BUCKETS = 160;  // 4 sub-buckets per power of two of ns
+
+struct PhaseStats {
+  int64_t recent[PROF_WINDOW];
+  int recentPos, recentCount;
+  uint64_t hist[PROF_BUCKETS];
+  uint64_t count;
+  int64_t total, maxNs;
+  uint64_t allocs, allocBytes;
+};
+
+PhaseStats profStats[PH_COUNT];
+int64_t profCurFrame[PH_COUNT];   // phase times of the frame in progress
+int64_t profWorstFrame[PH_COUNT]; // breakdown of the slowest frame so far
+uint64_t profCurAllocs[PH_COUNT];   // allocations of the frame in progress
+uint64_t profLastAllocs[PH_COUNT];  // allocations of the last finished frame
+uint64_t profCurAllocBytes[PH_COUNT], profLastAllocBytes[PH_COUNT];
+int profWorstFrameNo = -1;
+int profFrameNo = 0;
+bool profOverlay = false;  // toggled with 'P' in game
+bool profDumpOnExit = false;
+bool needClear = false;    // full clear before the next frame (overlay toggled)
+
+// fixed-timestep loop counters (see runGameLoop)
+long loopRenders = 0;       // frames drawn and written
+long loopCatchUpTicks = 0;  // extra ticks run back-to-back after falling behind
+long loopSkippedFrames = 0; // render slots missed because a frame ran late
+long loopDroppedTicks = 0;  // backlog beyond the catch-up limit (game slowed)
+
+int profBucket(int64_t ns) {
+  if (ns < 4) return (int)max<int64_t>(ns, 0);
+  int lg = 0;
+  while ((ns >> (lg+1)) != 0) lg++;
+  int b = (lg-1)*4 + (int)((ns >> (lg-2)) & 3);
+  return min(b, PROF_BUCKETS-1);
+}
+
+int64_t profBucketLow(int b) {
+  if (b < 4) return b;
+  int lg = b/4 + 1;
+  return (int64_t)(4 + b%4) << (lg-2);
+}
+
+void statsAdd(PhaseStats &st, int64_t ns) {
+  st.recent[st.recentPos] = ns;
+  st.recentPos = (st.recentPos + 1) % PROF_WINDOW;
+  if (st.recentCount < PROF_WINDOW) st.recentCount++;
+  st.hist[profBucket(ns)]++;
+  st.count++;
+  st.total += ns;
+  st.maxNs = max(st.maxNs, ns);
+}
+
+void profRecord(ProfPhase ph, int64_t ns, uint64_t allocs, uint64_t allocBytes) {
+  PhaseStats &st = profStats[ph];
+  statsAdd(st, ns);
+  st.allocs += allocs;
+  st.allocBytes += allocBytes;
+  profCurFrame[ph] += ns;
+  profCurAllocs[ph] += allocs;
+  profCurAllocBytes[ph] += allocBytes;
+}
+
+// percentile over the recent window (pct in 0..100)
+int64_t statsRecentPct(const PhaseStats &st, int pct) {
+  if (st.recentCount == 0) return 0;
+  int64_t tmp[PROF_WINDOW];
+  copy(st.recent, st.recent + st.recentCount, tmp);
+  int k = min(st.recentCount-1, st.recentCount * pct / 100);
+  nth_element(tmp, tmp + k, tmp + st.recentCount);
+  return tmp[k];
+}
+
+// percentile over the whole run, from the histogram (bucket lower bound)
+int64_t statsHistPct(const PhaseStats &st, int pct) {
+  if (st.count == 0) return 0;
+  uint64_t want = (st.count * pct + 99) / 100, seen = 0;
+  for (int b=0;b<PROF_BUCKETS;b++) {
+    seen += st.hist[b];
+    if (seen >= want) return profBucketLow(b);
+  }
+  return st.maxNs;
+}
+
+int64_t profRecentPct(ProfPhase ph, int pct) { return statsRecentPct(profStats[ph], pct); }
+int64_t profHistPct(ProfPhase ph, int pct) { return statsHistPct(profStats[ph], pct); }
+
+// Input-to-photon latency: keys consumed by a tick wait here until the first
+// frame drawn after that tick has been completely written to the terminal.
+PhaseStats inputLatency;
+PhaseStats gameLatency;  // the same, for the current game only (cleared by resetGame)
+const int LAT_PENDING_MAX = 64;
+int64_t latPending[LAT_PENDING_MAX];
+int latPendingCount = 0;
+
+void latNoteKey(int64_t ts) {
+  if (latPendingCount < LAT_PENDING_MAX) latPending[latPendingCount++] = ts;
+}
+
+// moves the consumed keys onto a frame that is about to be queued
+void latTakePending(int64_t *dst, int &n) {
+  for (int i=0;i<latPendingCount && n<LAT_PENDING_MAX;i++) dst[n++] = latPending[i];
+  latPendingCount = 0;
+}
+
+// the frame carrying these keys has been completely written
+void latFrameWritten(const int64_t *keys, int n) {
+  if (n == 0) return;
+  int64_t now = steadyNowNs();
+  for (int i=0;i<n;i++) {
+    statsAdd(inputLatency, now - keys[i]);
+    statsAdd(gameLatency, now - keys[i]);
+  }
+}
+
+void profBeginFrame() {
+  fill(profCurFrame, profCurFrame + PH_COUNT, 0);
+  fill(profCurAllocs, profCurAllocs + PH_COUNT, 0);
+  fill(profCurAllocBytes, profCurAllocBytes + PH_COUNT, 0);
+}
+
+void profEndFrame() {
+  copy(profCurAllocs, profCurAllocs + PH_COUNT, profLastAllocs);
+  copy(profCurAllocBytes, profCurAllocBytes + PH_COUNT, profLastAllocBytes);
+  if (profWorstFrameNo < 0 || profCurFrame[PH_FRAME] > profWorstFrame[PH_FRAME]) {
+    copy(profCurFrame, profCurFrame + PH_COUNT, profWorstFrame);
+    profWorstFrameNo = profFrameNo;
+  }
+  profFrameNo++;
+}
+
+inline int64_t profNowNs() { return steadyNowNs(); }
+
+// ---------- Tracing ----------
+// Opt-in Chrome/Perfetto trace (--trace=FILE). Every thread owns a
+// single-producer ring of complete events; the rings are only read when the
+// trace is written on exit, so recording is a couple of stores per scope.
+struct TraceEvent { const char *name; int64_t ts, dur; };
+const int TRACE_RING = 1 << 16;  // events kept per thread (oldest overwritten)
+
+struct TraceRing {
+  TraceEvent ev[TRACE_RING];
+  atomic<uint64_t> head{0};
+  int tid = 0;
+  const char *threadName = "";
+};
+
+bool traceEnabled = false;
+string tracePath;
+int64_t traceStartNs = 0;
+mutex traceMu;                 // guards registration only
+vector<TraceRing*> traceRings;
+thread_local TraceRing *tlsTraceRing = nullptr;
+
+TraceRing *traceRing() {
+  if (!tlsTraceRing) {
+    TraceRing *r = new TraceRing;
+    lock_guard<mutex> lk(traceMu);
+    r->tid = (int)traceRings.size() + 1;
+    r->threadName = tlsThreadName;
+    traceRings.push_back(r);
+    tlsTraceRing = r;
+  }
+  return tlsTraceRing;
+}
+
+inline void traceEmit(const char *name, int64_t t0, int64_t t1) {
+  TraceRing *r = traceRing();
+  uint64_t h = r->head.load(memory_order_relaxed);
+  r->ev[h & (TRACE_RING-1)] = TraceEvent{name, t0, t1 - t0};
+  r->head.store(h + 1, memory_order_release);
+}
+
+struct TraceScope {
+  const char *name;
+  int64_t t0;
+  TraceScope(const char *n) : name(n), t0(traceEnabled ? profNowNs() : 0) {}
+  ~TraceScope() { if (traceEnabled) traceEmit(name, t0, profNowNs()); }
+};
+
+bool writeTrace(const string &path) {
+  FILE *f = fopen(path.c_str(), "w");
+  if (!f) return false;
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"tank_shooter\"}}");
+  lock_guard<mutex> lk(traceMu);
+  for (TraceRing *r: traceRings) {
+    fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            r->tid, r->threadName);
+    uint64_t head = r->head.load(memory_order_acquire);
+    uint64_t first = head > (uint64_t)TRACE_RING ? head - TRACE_RING : 0;
+    for (uint64_t i=first; i<head; i++) {
+      const TraceEvent &e = r->ev[i & (TRACE_RING-1)];
+      fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+              e.name, r->tid, (e.ts - traceStartNs) / 1000.0, e.dur / 1000.0);
+    }
+  }
+  fprintf(f, "\n]}\n");
+  return fclose(f) == 0;
+}
+
+// ---------- Hardware counters ----------
+// Opt-in (--perf-counters) cycles/instructions/cache-miss/branch-miss counts
+// per loop phase, read as one perf_event_open group around each phase scope.
+enum HwCounter { HW_CYCLES, HW_INSTR, HW_CACHE_MISS, HW_BRANCH_MISS, HW_COUNT };
+bool hwEnabled = false;
+uint64_t hwTotals[PH_COUNT][HW_COUNT];
+
+#if defined(__linux__)
+int hwFds[HW_COUNT] = {-1, -1, -1, -1};
+
+bool hwInit() {
+  const uint64_t configs[HW_COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                       PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+  for (int i=0;i<HW_COUNT;i++) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.disabled = i == 0;  // the leader starts the whole group
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    hwFds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : hwFds[0], 0);
+    if (hwFds[i] < 0) {
+      cerr << "perf_event_open failed: " << strerror(errno)
+           << " (check /proc/sys/kernel/perf_event_paranoid); hardware counters disabled\n";
+      for (int j=0;j<i;j++) { close(hwFds[j]); hwFds[j] = -1; }
+      return false;
+    }
+  }
+  ioctl(hwFds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+// one read() returns the whole group, scaled if the PMU was multiplexed
+inline void hwRead(uint64_t v[HW_COUNT]) {
+  struct { uint64_t nr, enabled, running, values[HW_COUNT]; } g;
+  if (read(hwFds[0], &g, sizeof(g)) != (ssize_t)sizeof(g) || g.running == 0) {
+    fill(v, v + HW_COUNT, 0);
+    return;
+  }
+  for (int i=0;i<HW_COUNT;i++)
+    v[i] = g.enabled == g.running ? g.values[i] : (uint64_t)((double)g.values[i] * g.enabled / g.running);
+}
+#else
+bool hwInit() {
+  cerr << "hardware counters need Linux perf_event_open; disabled\n";
+  return false;
+}
+inline void hwRead(uint64_t v[HW_COUNT]) { fill(v, v + HW_COUNT, 0); }
+#endif
+
+// the update phase is reported as the sum of its three passes
+void hwPhaseGroup(int group, uint64_t v[HW_COUNT], const char *&name) {
+  static const char *names[] = { "update", "draw", "encode", "write" };
+  static const ProfPhase first[] = { PH_MOVE, PH_DRAW, PH_ENCODE, PH_WRITE };
+  static const ProfPhase last[] = { PH_CLEANUP, PH_DRAW, PH_ENCODE, PH_WRITE };
+  name = names[group];
+  fill(v, v + HW_COUNT, 0);
+  for (int ph=first[group]; ph<=last[group]; ph++)
+    for (int i=0;i<HW_COUNT;i++) v[i] += hwTotals[ph][i];
+}
+
+// IPC plus cache and branch misses per thousand instructions
+int formatHwRates(char *buf, size_t len, const char *name, const uint64_t v[HW_COUNT]) {
+  double kinstr = max(1.0, v[HW_INSTR] / 1000.0);
+  return snprintf(buf, len, " %-6s IPC %4.2f cache-MPKI %5.2f branch-MPKI %5.2f", name,
+                  v[HW_CYCLES] ? (double)v[HW_INSTR] / v[HW_CYCLES] : 0.0,
+                  v[HW_CACHE_MISS] / kinstr, v[HW_BRANCH_MISS] / kinstr);
+}
+
+void appendHwOverlay(string &out) {
+  char buf[128];
+  for (int g=0; g<4; g++) {
+    uint64_t v[HW_COUNT];
+    const char *name;
+    hwPhaseGroup(g, v, name);
+    out += g == 0 ? " HW " : "    ";
+    formatHwRates(buf, sizeof(buf), name, v);
+    out += buf;
+    out += "\x1B[K\n";
+  }
+}
+
+void dumpHwCounters(ostream &os, uint64_t frames) {
+  char buf[200];
+  os << "\n===== Hardware counters (per frame) =====\n";
+  for (int g=0; g<4; g++) {
+    uint64_t v[HW_COUNT];
+    const char *name;
+    hwPhaseGroup(g, v, name);
+    formatHwRates(buf, sizeof(buf), name, v);
+    os << buf;
+    snprintf(buf, sizeof(buf), "  cycles %.0f instr %.0f\n",
+             (double)v[HW_CYCLES] / max<uint64_t>(frames, 1), (double)v[HW_INSTR] / max<uint64_t>(frames, 1));
+    os << buf;
+  }
+}
+
+// times a profiler phase and, when tracing, emits it as a trace event
+const char *PHASE_TRACE_NAMES[PH_COUNT] = {
+  "processInputGameplay", "updateMovement", "updateCollisions", "updateCleanup",
+  "draw", "buildOutputBuffer", "write", "frame" };
+
+struct PhaseScope {
+  ProfPhase ph;
+  int64_t t0;
+  uint64_t a0, b0;
+  uint64_t h0[HW_COUNT];
+  bool keep = true;
+  PhaseScope(ProfPhase p) : ph(p), t0(tlsPoolThread ? 0 : profNowNs()), a0(tlsAllocCount), b0(tlsAllocBytes) {
+    if (hwEnabled && !tlsPoolThread) hwRead(h0);
+  }
+  void discard() { keep = false; }  // nothing worth a sample happened after all
+  ~PhaseScope() {
+    if (tlsPoolThread || !keep) return;
+    if (hwEnabled) {
+      uint64_t h1[HW_COUNT];
+      hwRead(h1);
+      for (int i=0;i<HW_COUNT;i++) hwTotals[ph][i] += h1[i] - h0[i];
+    }
+    int64_t t1 = profNowNs();
+    profRecord(ph, t1 - t0, tlsAllocCount - a0, tlsAllocBytes - b0);
+    if (traceEnabled) traceEmit(PHASE_TRACE_NAMES[ph], t0, t1);
+  }
+};
+
+// two overlay lines of "phase p50/p99" in microseconds
+void appendProfOverlay(string &out) {
+  char buf[160];
+  for (int line=0; line<2; line++) {
+    out += line == 0 ? " PROF p50/p99 us" : "                ";
+    for (int ph=line*4; ph<line*4+4; ph++) {
+      snprintf(buf, sizeof(buf), " %-7s%6.1f/%-6.1f", PHASE_NAMES[ph],
+               profRecentPct((ProfPhase)ph, 50) / 1000.0, profRecentPct((ProfPhase)ph, 99) / 1000.0);
+      out += buf;
+    }
+    out += "\x1B[K\n";
+  }
+  snprintf(buf, sizeof(buf), " ALLOC last frame %llu (%lluB):", (unsigned long long)profLastAllocs[PH_FRAME],
+           (unsigned long long)profLastAllocBytes[PH_FRAME]);
+  out += buf;
+  for (int ph=0; ph<PH_FRAME; ph++) {
+    snprintf(buf, sizeof(buf), " %s %llu", PHASE_NAMES[ph], (unsigned long long)profLastAllocs[ph]);
+    out += buf;
+  }
+  out += "\x1B[K\n";
+  snprintf(buf, sizeof(buf), " LOOP renders %ld  catch-up ticks %ld  skipped frames %ld  dropped ticks %ld\x1B[K\n",
+           loopRenders, loopCatchUpTicks, loopSkippedFrames, loopDroppedTicks);
+  out += buf;
+  appendNetOverlay(out);
+  if (hwEnabled) appendHwOverlay(out);
+}
+
+// one row per power of two of the log-linear buckets
+void dumpHistogram(ostream &os, const PhaseStats &st) {
+  char buf[80];
+  uint64_t peak = 0, rows[PROF_BUCKETS/4 + 1] = {};
+  for (int b=0;b<PROF_BUCKETS;b++) rows[b/4] += st.hist[b];
+  for (auto r: rows) peak = max(peak, r);
+  for (int r=0;r<PROF_BUCKETS/4;r++) {
+    if (rows[r] == 0) continue;
+    int bar = (int)(rows[r] * 50 / peak);
+    snprintf(buf, sizeof(buf), "   >= %11.3fus %8llu |", profBucketLow(r*4) / 1000.0, (unsigned long long)rows[r]);
+    os << buf << string(max(bar, 1), '#') << "\n";
+  }
+}
+
+void dumpProfile(ostream &os) {
+  if (profStats[PH_FRAME].count == 0) return;
+  char buf[200];
+  os << "\n===== Frame profile (" << profStats[PH_FRAME].count << " frames) =====\n";
+  for (int ph=0; ph<PH_COUNT; ph++) {
+    const PhaseStats &st = profStats[ph];
+    if (st.count == 0) continue;
+    snprintf(buf, sizeof(buf), "%-8s n=%-7llu mean %9.1fus  p50 %9.1fus  p99 %9.1fus  max %9.1fus\n",
+             PHASE_NAMES[ph], (unsigned long long)st.count, st.total / 1000.0 / st.count,
+             profHistPct((ProfPhase)ph, 50) / 1000.0, profHistPct((ProfPhase)ph, 99) / 1000.0,
+             st.maxNs / 1000.0);
+    os << buf;
+    snprintf(buf, sizeof(buf), "         allocs %llu (%llu bytes), %.2f per frame\n",
+             (unsigned long long)st.allocs, (unsigned long long)st.allocBytes,
+             (double)st.allocs / profStats[PH_FRAME].count);
+    os << buf;
+    dumpHistogram(os, st);
+  }
+  if (inputLatency.count) {
+    snprintf(buf, sizeof(buf), "input latency n=%llu  mean %.2fms  p50 %.2fms  p99 %.2fms  max %.2fms\n",
+             (unsigned long long)inputLatency.count, inputLatency.total / 1e6 / inputLatency.count,
+             statsHistPct(inputLatency, 50) / 1e6, statsHistPct(inputLatency, 99) / 1e6, inputLatency.maxNs / 1e6);
+    os << buf;
+    dumpHistogram(os, inputLatency);
+  }
+  os << "loop: " << loopRenders << " renders, " << loopCatchUpTicks << " catch-up ticks, "
+     << loopSkippedFrames << " skipped frames, " << loopDroppedTicks << " dropped ticks\n";
+  snprintf(buf, sizeof(buf), "output: %.1f KB/s sustained, write %.2fms avg, link estimate %.1f KB/s, final detail %s\n",
+           netBytesPerSec / 1024, netWriteNsEwma / 1e6, netLinkEstimate / 1024, DETAIL_LEVELS[detailLevel].name);
+  os << buf;
+  os << "slowest frame #" << profWorstFrameNo << ":";
+  for (int ph=0; ph<PH_COUNT; ph++) {
+    snprintf(buf, sizeof(buf), " %s %.1fus", PHASE_NAMES[ph], profWorstFrame[ph] / 1000.0);
+    os << buf;
+  }
+  os << "\n";
+  if (hwEnabled) dumpHwCounters(os, profStats[PH_FRAME].count);
+  os << "heap: " << gAllocCount.load() << " allocations, " << gAllocBytes.load() << " bytes, "
+     << gFreeCount.load() << " frees\n";
+  dumpPool(os);
+}
 
 // ---------- Utility ----------
 inline void clampPos(int &x, int &y) {
@@ -208,6 +1299,23 @@ inline void clampPos(int &x, int &y) {
 
 vector<string> createEmptyScreen() { return vector<string>(HEIGHT, string(WIDTH, ' ')); }
 
+// wipe a screen in place so the frame buffer is reused every tick
+void clearScreen(vector<string> &scr) {
+  for (auto &row: scr) row.assign(WIDTH, ' ');
+}
+
+// per-cell color set by draw code next to the glyph; 0 keeps the glyph's own
+struct AttrPlane {
+  uint8_t a[HEIGHT][WIDTH];
+  bool row[HEIGHT];  // rows holding any override
+};
+AttrPlane screenAttr;
+
+void clearAttrPlane(AttrPlane &p) {
+  for (int y=0;y<HEIGHT;y++)
+    if (p.row[y]) { memset(p.a[y], 0, WIDTH); p.row[y] = false; }
+}
+
 void drawBorder(vector<string> &scr) {
   for (int x=0;x<WIDTH;x++) scr[0][x] = '-';
   for (int x=0;x<WIDTH;x++) scr[HEIGHT-1][x] = '-';
@@ -217,52 +1325,98 @@ void drawBorder(vector<string> &scr) {
   }
 }
 
+// Starfield behind the arena: two layers of hash-placed stars drifting down,
+// the far one at half the near one's speed. Layers are precomputed as
+// tall tiles so drawing is a row lookup.
+const int STAR_PERIOD = 256;  // rows before a layer repeats
+bool starsEnabled = true;     // --no-stars
+int starScroll = 0;           // rows the near layer has moved
+bool starsInFrame = false;    // the arena being encoded shows the starfield
+char starTile[2][STAR_PERIOD][WIDTH];
+uint8_t starX[2][STAR_PERIOD][WIDTH];  // columns holding a star, per tile row
+uint8_t starCount[2][STAR_PERIOD];
+
+uint32_t starHash(uint32_t x, uint32_t y) {
+  uint32_t h = x * 0x9E3779B1u ^ y * 0x85EBCA77u;
+  h ^= h >> 15;
+  h *= 0x2C1B3C6Du;
+  h ^= h >> 12;
+  return h;
+}
+
+void initStars() {
+  for (int y=0;y<STAR_PERIOD;y++)
+    for (int x=0;x<WIDTH;x++) {
+      starTile[0][y][x] = starHash(x, y) % 48 == 0 ? '.' : ' ';
+      starTile[1][y][x] = starHash(x + 7919, y) % 300 == 0 ? '`' : ' ';
+    }
+  for (int l=0;l<2;l++)
+    for (int y=0;y<STAR_PERIOD;y++)
+      for (int x=1;x<WIDTH-1;x++)
+        if (starTile[l][y][x] != ' ') starX[l][y][starCount[l][y]++] = x;
+}
+
+// tile row shown on screen row y of a layer (0 near, 1 far) at the current scroll
+int starTileRow(int layer, int y) {
+  int s = layer == 0 ? starScroll : starScroll / 2;
+  return ((y - s) % STAR_PERIOD + STAR_PERIOD) % STAR_PERIOD;
+}
+
+const char *starRow(int layer, int y) { return starTile[layer][starTileRow(layer, y)]; }
+
+// calls f(x, glyph) for each star visible on arena row y (near ones hide far ones)
+template<class F> void forEachStar(int y, F f) {
+  int tn = starTileRow(0, y), tf = starTileRow(1, y);
+  for (int i=0; i<starCount[0][tn]; i++) f(starX[0][tn][i], starTile[0][tn][starX[0][tn][i]]);
+  for (int i=0; i<starCount[1][tf]; i++) {
+    int x = starX[1][tf][i];
+    if (starTile[0][tn][x] == ' ') f(x, starTile[1][tf][x]);
+  }
+}
+
+// drawn right after the border so everything else covers it
+void drawStars(vector<string> &scr) {
+  starsInFrame = starsEnabled;
+  if (!starsEnabled) return;
+  for (int y=1;y<HEIGHT-1;y++) {
+    char *row = &scr[y][0];
+    forEachStar(y, [row](int x, char c) { row[x] = c; });
+  }
+}
+
 // ---------- Drawings ----------
-void drawTankShape(vector<string> &scr, const Tank &t) {
+void drawTankShape(vector<string> &scr, const Tank &t, AttrPlane *attrs = nullptr) {
+  // a tank cell also drops any color override (an explosion drawn under it)
+  auto plot = [&](int nx, int ny, char ch) {
+    if (nx<1 || nx>=WIDTH-1 || ny<1 || ny>=HEIGHT-1) return;
+    scr[ny][nx] = ch;
+    if (attrs) attrs->a[ny][nx] = 0;
+  };
   if (t.type == "Standard") {
-    vector<pair<int,int>> shape = {{0,0},{-1,-1},{1,-1},{-2,-2},{0,-2},{2,-2},{0,-3}};
-    for (auto &p : shape) {
-      int nx = t.x + p.first, ny = t.y + p.second;
-      if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) scr[ny][nx] = '*';
-    }
+    static const pair<int,int> shape[] = {{0,0},{-1,-1},{1,-1},{-2,-2},{0,-2},{2,-2},{0,-3}};
+    for (auto &p : shape) plot(t.x + p.first, t.y + p.second, '*');
   } else if (t.type == "Heavy") {
-    vector<pair<int,int>> shape = {{0,0},{-1,0},{1,0},{-2,-1},{-1,-1},{0,-1},{1,-1},{2,-1}};
-    for (auto &p : shape) {
-      int nx = t.x + p.first, ny = t.y + p.second;
-      if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) scr[ny][nx] = '#';
-    }
+    static const pair<int,int> shape[] = {{0,0},{-1,0},{1,0},{-2,-1},{-1,-1},{0,-1},{1,-1},{2,-1}};
+    for (auto &p : shape) plot(t.x + p.first, t.y + p.second, '#');
   } else if (t.type == "Light") {
-    vector<pair<int,int>> shape = {{0,0},{0,-1},{-1,0},{1,0},{0,1}};
-    for (auto &p : shape) {
-      int nx = t.x + p.first, ny = t.y + p.second;
-      if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) scr[ny][nx] = '+';
-    }
+    static const pair<int,int> shape[] = {{0,0},{0,-1},{-1,0},{1,0},{0,1}};
+    for (auto &p : shape) plot(t.x + p.first, t.y + p.second, '+');
   } else if (t.type == "Sniper") {
-    vector<pair<int,int>> shape = {{0,-2},{0,0},{0,-1},{-1,0},{1,0}};
-    for (auto &p : shape) {
-      int nx = t.x + p.first, ny = t.y + p.second;
-      if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) scr[ny][nx] = (p.first==0 && p.second==-2) ? '^' : (p.first==0 && p.second==-1 ? '^' : (p.first==0 && p.second==0 ? 'v' : '|'));
-    }
+    static const pair<int,int> shape[] = {{0,-2},{0,0},{0,-1},{-1,0},{1,0}};
+    for (auto &p : shape) plot(t.x + p.first, t.y + p.second, (p.first==0 && p.second==-2) ? '^' : (p.first==0 && p.second==-1 ? '^' : (p.first==0 && p.second==0 ? 'v' : '|')));
   } else if (t.type == "RapidFire") {
-    vector<pair<int,int>> shape = {{-1,0},{0,0},{1,0},{0,-1},{0,-2}};
-    for (auto &p : shape) {
-      int nx = t.x + p.first, ny = t.y + p.second;
-      if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) scr[ny][nx] = '=';
-    }
+    static const pair<int,int> shape[] = {{-1,0},{0,0},{1,0},{0,-1},{0,-2}};
+    for (auto &p : shape) plot(t.x + p.first, t.y + p.second, '=');
   } else if (t.type == "Plasma") {
-    vector<pair<int,int>> shape = {{0,0},{-1,-1},{1,-1},{-1,1},{1,1}};
-    for (auto &p : shape) {
-      int nx = t.x + p.first, ny = t.y + p.second;
-      if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) scr[ny][nx] = (p.first==0 && p.second==0) ? 'O' : 'o';
-    }
+    static const pair<int,int> shape[] = {{0,0},{-1,-1},{1,-1},{-1,1},{1,1}};
+    for (auto &p : shape) plot(t.x + p.first, t.y + p.second, (p.first==0 && p.second==0) ? 'O' : 'o');
   } else {
-    int nx = t.x, ny = t.y;
-    if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) scr[ny][nx] = '*';
+    plot(t.x, t.y, '*');
   }
 }
 
 void drawEnemyShape(vector<string> &scr, const Enemy &e) {
-  bool blink = (tickCount/5)%2;
+  bool blink = animEffects && (tickCount/5)%2;
   switch (e.type) {
     case NORMAL: {
       for (int dy=0; dy<2; ++dy)
@@ -274,17 +1428,17 @@ void drawEnemyShape(vector<string> &scr, const Enemy &e) {
       break;
     }
     case FAST: {
-      string s = blink ? "/^\\" : "\\_/";
+      const char *s = blink ? "/^\\" : "\\_/";
       int baseX = e.x - 1, baseY = e.y;
-      for (int i=0;i<(int)s.size();++i) {
+      for (int i=0;i<3;++i) {
         int nx = baseX + i, ny = baseY;
         if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) scr[ny][nx] = s[i];
       }
       break;
     }
     case STRONG: {
-      const string shape0 = "+-+";
-      const string shape1 = "+-+";
+      const char *shape0 = "+-+";
+      const char *shape1 = "+-+";
       for (int dx=0; dx<3; ++dx) {
         int nx0 = e.x + dx - 1, ny0 = e.y - 1;
         int nx1 = e.x + dx - 1, ny1 = e.y;
@@ -294,7 +1448,7 @@ void drawEnemyShape(vector<string> &scr, const Enemy &e) {
       break;
     }
     case BOUNCER: {
-      vector<pair<int,int>> parts = {{0,0},{-1,0},{1,0},{0,1}};
+      static const pair<int,int> parts[] = {{0,0},{-1,0},{1,0},{0,1}};
       for (auto &p: parts) {
         int nx = e.x + p.first, ny = e.y + p.second;
         if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) scr[ny][nx] = (p.first==0 && p.second==0) ? '&' : '=';
@@ -302,7 +1456,7 @@ void drawEnemyShape(vector<string> &scr, const Enemy &e) {
       break;
     }
     case ZIGZAG: {
-      vector<pair<int,int>> parts = {{0,0},{1,1},{-1,1}};
+      static const pair<int,int> parts[] = {{0,0},{1,1},{-1,1}};
       for (auto &p: parts) {
         int nx = e.x + p.first, ny = e.y + p.second;
         if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) scr[ny][nx] = 'Z';
@@ -316,7 +1470,7 @@ void drawEnemyShape(vector<string> &scr, const Enemy &e) {
     }
     case BOSS: {
       // 5x2 boss
-      string s0="+---+", s1="+---+";
+      const char *s0="+---+", *s1="+---+";
       for (int dx=0; dx<5; ++dx) {
         int nx0 = e.x + dx - 2, ny0 = e.y;
         int nx1 = e.x + dx - 2, ny1 = e.y + 1;
@@ -332,17 +1486,24 @@ void drawBulletShape(vector<string> &scr, const Bullet &b) {
   if (b.x>=1 && b.x<WIDTH-1 && b.y>=1 && b.y<HEIGHT-1) scr[b.y][b.x] = b.ch;
 }
 
-void drawExplosions(vector<string> &scr) {
+void drawExplosions(vector<string> &scr, AttrPlane &attrs) {
   for (auto &ex: explosions) {
-    int phase = ex.life % 3;
-    vector<pair<int,int>> parts;
-    if (phase == 0) parts = {{0,0}};
-    else if (phase == 1) parts = {{0,0},{-1,0},{1,0},{0,-1},{0,1}};
-    else parts = {{-1,-1},{1,-1},{-1,1},{1,1}};
-    for (auto &p: parts) {
+    static const pair<int,int> dot[] = {{0,0}};
+    static const pair<int,int> cross[] = {{0,0},{-1,0},{1,0},{0,-1},{0,1}};
+    static const pair<int,int> corners[] = {{-1,-1},{1,-1},{-1,1},{1,1}};
+    int phase = animEffects ? ex.life % 3 : 1;
+    const pair<int,int> *parts = phase == 0 ? dot : (phase == 1 ? cross : corners);
+    int n = phase == 0 ? 1 : (phase == 1 ? 5 : 4);
+    for (int i=0;i<n;i++) {
+      const pair<int,int> &p = parts[i];
       int nx = ex.x + p.first, ny = ex.y + p.second;
-      if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1)
+      if (nx>=1 && nx<WIDTH-1 && ny>=1 && ny<HEIGHT-1) {
         scr[ny][nx] = '*';
+        if (expGradient) {
+          attrs.a[ny][nx] = expGradientAttr[max(0, min(EXPLOSION_FRAMES-1, EXPLOSION_FRAMES - ex.life))];
+          attrs.row[ny] = true;
+        }
+      }
     }
   }
 }
@@ -368,11 +1529,52 @@ void drawLaser(vector<string> &scr) {
   }
 }
 
+// ---------- World hash ----------
+// A 64-bit hash of everything the simulation reads, refreshed after every
+// tick (and on reset) into worldHash. Lockstep peers exchange it and .tkr
+// recordings log it per frame, so two runs can be checked for bit-exact
+// agreement tick by tick. Small fields are packed 16 bits at a time, which
+// keeps it to a few words per entity: well under a microsecond a tick.
+thread_local uint64_t worldHash = 0;
+
+inline uint64_t hashStep(uint64_t h, uint64_t v) {
+  h = (h ^ v) * 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 29);
+}
+
+inline uint64_t pack16(int a, int b, int c = 0, int d = 0) {
+  return (uint64_t)(uint16_t)a | (uint64_t)(uint16_t)b << 16 | (uint64_t)(uint16_t)c << 32 | (uint64_t)(uint16_t)d << 48;
+}
+
+uint64_t hashWorld() {
+  uint64_t h = hashStep(0, rngState);
+  h = hashStep(h, pack16(level, enemySpawnRate, rapidFireTimer, damageBoostTimer));
+  h = hashStep(h, (uint64_t)(uint32_t)score | (uint64_t)(uint32_t)tickCount << 32);
+  h = hashStep(h, pack16(laser.y, laser.life, laser.active, playerCount));
+  for (int i=0;i<playerCount;i++) {
+    const Tank &t = players[i];
+    h = hashStep(h, pack16(t.x, t.y, t.hp, t.shieldCount));
+    h = hashStep(h, pack16(t.speed, t.fireRate, t.shotDamage, t.shotCount));
+    h = hashStep(h, pack16(t.cooldown, t.alive) | (uint64_t)(uint32_t)t.score << 32);
+  }
+  h = hashStep(h, pack16((int)bullets.size(), (int)enemies.size(), (int)explosions.size(), (int)items.size()));
+  for (auto &b: bullets) h = hashStep(h, pack16(b.x, b.y, b.dmg, (uint8_t)b.dy | b.owner << 8));
+  for (auto &e: enemies) {
+    h = hashStep(h, pack16(e.x, e.y, e.hp, e.dir));
+    h = hashStep(h, pack16(e.type, e.skillCooldown));
+  }
+  for (auto &e: explosions) h = hashStep(h, pack16(e.x, e.y, e.life));
+  for (auto &it: items) h = hashStep(h, pack16(it.x, it.y, it.t, it.life));
+  h = hashStep(h, bombs.size());
+  for (auto &b: bombs) h = hashStep(h, pack16(b.x, b.y, b.dy));
+  return h;
+}
+
 // ---------- Logic ----------
 void spawnEnemiesByLevel() {
-  int cnt = 1 + rand() % min(4, level + 1);
+  int cnt = 1 + gameRand() % min(4, level + 1);
   for (int i=0;i<cnt;i++) {
-    int r = rand() % 100;
+    int r = gameRand() % 100;
     EnemyType t;
     if (r < 40) t = NORMAL;
     else if (r < 60) t = FAST;
@@ -380,7 +1582,7 @@ void spawnEnemiesByLevel() {
     else if (r < 88) t = BOUNCER;
     else if (r < 96) t = ZIGZAG;
     else t = CHASER;
-    enemies.emplace_back(2 + rand() % (WIDTH - 6), 2 + rand()%2, t);
+    enemies.emplace_back(2 + gameRand() % (WIDTH - 6), 2 + gameRand()%2, t);
   }
 }
 
@@ -396,9 +1598,9 @@ void spawnBoss(){
 
 // drop item with small chance on enemy death
 void maybeDropItem(int x,int y) {
-  int r = rand()%100;
+  int r = gameRand()%100;
   if (r < 12) { // 12% chance to drop something
-    int t = rand()%100;
+    int t = gameRand()%100;
     if (t < 40) items.emplace_back(x,y, IT_HEALTH);
     else if (t < 65) items.emplace_back(x,y, IT_RAPID);
     else if (t < 85) items.emplace_back(x,y, IT_DAMAGE);
@@ -406,76 +1608,100 @@ void maybeDropItem(int x,int y) {
   }
 }
 
-void processInputGameplay() {
-  static int shootCooldown = 0;
-  shootCooldown = max(0, shootCooldown - 1);
-
-  while (kb_hit()) {
-    int c = kb_get();
-    if (c >= 'A' && c <= 'Z') c += 32;
-    if (c == 'a') player.x -= player.speed;
-    else if (c == 'd') player.x += player.speed;
-    else if (c == 'w') player.y -= player.speed;
-    else if (c == 's') player.y += player.speed;
-    else if (c == ' ' && shootCooldown == 0) {
-      // choose bullet char by player.type
-      char bch = '|';
-      if (player.type == "Standard") bch = '|';
-      else if (player.type == "Heavy") bch = '#';
-      else if (player.type == "Light") bch = ':';
-      else if (player.type == "Sniper") bch = '-';
-      else if (player.type == "RapidFire") bch = '!';
-      else if (player.type == "Plasma") bch = '*';
-
-      // spawn bullets according to shotCount
-      for (int s=0; s<player.shotCount; ++s) {
-        int ox = 0;
-        if (player.shotCount == 1) ox = 0;
-        else if (player.shotCount == 2) ox = (s==0)?-1:1;
-        else ox = s-1; // -1,0,1
-        bullets.emplace_back(player.x+ox, player.y-4, -1, player.shotDamage, bch);
-      }
+// movement and fire for one tank; shared by local input and lockstep peers
+void handleTankKey(int idx, int c) {
+  Tank &t = players[idx];
+  if (c >= 'A' && c <= 'Z') c += 32;
+  if (c == 'a') t.x -= t.speed;
+  else if (c == 'd') t.x += t.speed;
+  else if (c == 'w') t.y -= t.speed;
+  else if (c == 's') t.y += t.speed;
+  else if (c == ' ' && t.cooldown == 0 && t.alive) {
+    // choose bullet char by tank type
+    char bch = '|';
+    if (t.type == "Standard") bch = '|';
+    else if (t.type == "Heavy") bch = '#';
+    else if (t.type == "Light") bch = ':';
+    else if (t.type == "Sniper") bch = '-';
+    else if (t.type == "RapidFire") bch = '!';
+    else if (t.type == "Plasma") bch = '*';
 
-      // apply rapid fire if active (shorten cooldown)
-      int baseFR = player.fireRate;
-      if (rapidFireTimer > 0) baseFR = max(1, player.fireRate/2);
-      shootCooldown = baseFR;
+    // spawn bullets according to shotCount
+    for (int s=0; s<t.shotCount; ++s) {
+      int ox = 0;
+      if (t.shotCount == 1) ox = 0;
+      else if (t.shotCount == 2) ox = (s==0)?-1:1;
+      else ox = s-1; // -1,0,1
+      bullets.emplace_back(t.x+ox, t.y-4, -1, t.shotDamage, bch, idx);
     }
-    else if (c == 'q') running = false;
-    clampPos(player.x, player.y);
+
+    // apply rapid fire if active (shorten cooldown)
+    int baseFR = t.fireRate;
+    if (rapidFireTimer > 0) baseFR = max(1, t.fireRate/2);
+    t.cooldown = baseFR;
   }
+  else if (c == 'q') running = false;
+  clampPos(t.x, t.y);
 }
 
-void updateGameLogic() {
-  tickCount++;
+void handleGameplayKey(int c) {
+  if (c == 'p' || c == 'P') { profOverlay = !profOverlay; needClear = true; return; }
+  handleTankKey(0, c);
+}
 
-  // decrease power-up timers
-  if (rapidFireTimer > 0) rapidFireTimer--;
-  if (damageBoostTimer > 0) damageBoostTimer--;
+void processInputGameplay() {
+  for (int i=0;i<playerCount;i++) players[i].cooldown = max(0, players[i].cooldown - 1);
+  KeyEvent ev;
+  while (kb_poll(ev)) {
+    latNoteKey(ev.ts);
+    handleGameplayKey(ev.key);
+  }
+}
 
-  // move bullets
-  for (auto &b: bullets) b.y += b.dy;
-  bullets.erase(remove_if(bullets.begin(), bullets.end(),
-    [](const Bullet &b){ return b.y < 1 || b.y >= HEIGHT-1; }), bullets.end());
+// the live tank of ts[0..n) closest to (x,y); the first tank wins ties
+const Tank &nearestTank(const Tank *ts, int n, int x, int y) {
+  int best = 0, bestD = INT_MAX;
+  for (int i=0;i<n;i++) {
+    if (!ts[i].alive) continue;
+    int d = abs(ts[i].x - x) + abs(ts[i].y - y);
+    if (d < bestD) { bestD = d; best = i; }
+  }
+  return ts[best];
+}
 
-  // move bombs (boss bombs falling)
-  for (auto &bm: bombs) bm.y += bm.dy;
-  bombs.erase(remove_if(bombs.begin(), bombs.end(),
-    [](const Bomb &b){ return b.y >= HEIGHT-1; }), bombs.end());
+// a tank took a hit with no shield left; returns false when that ends the game
+bool killTank(Tank &t) {
+  t.alive = false;
+  int left = 0;
+  for (int i=0;i<playerCount;i++) left += players[i].alive;
+  if (left == 0 || (versus && left <= 1)) { running = false; return false; }
+  return true;
+}
 
-  // global delay to slow enemies slightly
-  int globalDelay = max(2, 10 - level/2);
+// One tick of enemy AI over a range of enemies. It may run on any pool
+// thread, so it reads the world only through EnemyStep and touches nothing
+// global: a boss whose skill is due is noted in due (in index order) and
+// bossSkill() runs it once every chunk is done.
+struct EnemyStep {
+  Enemy *enemies;
+  const Tank *tanks;
+  int tankCount;
+  int tick;
+  int globalDelay;  // ticks between steps, to slow enemies slightly
+};
 
-  for (auto &e : enemies) {
+void moveEnemies(const EnemyStep &st, int lo, int hi, vector<int> &due) {
+  for (int i=lo; i<hi; i++) {
+    Enemy &e = st.enemies[i];
     bool doMove = false;
     if (e.type == FAST) {
-      int d = max(1, globalDelay/2);
-      doMove = (tickCount % d) == 0;
+      int d = max(1, st.globalDelay/2);
+      doMove = (st.tick % d) == 0;
     } else if (e.type == BOSS) {
       // boss moves less frequently
-      doMove = (tickCount % 4) == 0;
+      doMove = (st.tick % 4) == 0;
     } else {
-      doMove = (tickCount % globalDelay) == 0;
+      doMove = (st.tick % st.globalDelay) == 0;
     }
     if (!doMove) continue;
 
@@ -491,12 +1717,13 @@ void updateGameLogic() {
       case ZIGZAG:
         e.y += 1;
         e.x += e.dir;
-        if (tickCount % 12 == 0) e.dir *= -1;
+        if (st.tick % 12 == 0) e.dir *= -1;
         if (e.x <= 2 || e.x >= WIDTH-3) e.dir *= -1;
         break;
       case CHASER: {
-        int dx = player.x - e.x;
-        int dy = player.y - e.y;
+        const Tank &tg = nearestTank(st.tanks, st.tankCount, e.x, e.y);
+        int dx = tg.x - e.x;
+        int dy = tg.y - e.y;
         if (abs(dx) <= 20 && abs(dy) <= 10) {
           e.x += (dx==0?0: (dx>0?1:-1));
           e.y += (dy==0?0: (dy>0?1:-1));
@@ -505,44 +1732,93 @@ void updateGameLogic() {
         }
         break;
       }
-      case BOSS: {
+      case BOSS:
         // boss moves horizontally and occasionally uses skills
         e.x += e.dir;
         if (e.x <= 3 || e.x >= WIDTH-4) e.dir *= -1;
 
         // boss skill cooldown handling
         if (e.skillCooldown > 0) e.skillCooldown--;
-        if (e.skillCooldown <= 0) {
-          // choose skill
-          int r = rand()%100;
-          bool strongPhase = (e.hp <= ( (20 + level*5) / 2 ));
-          if (r < 45) {
-            // laser
-            laser.active = true;
-            laser.y = e.y + 2; // sweep a row below boss
-            laser.life = strongPhase ? 10 : 6;
-          } else {
-            // bomb rain: spawn several bombs below boss
-            int count = strongPhase ? 8 : 5;
-            for (int b=0;b<count;b++) {
-              int bx = max(2, min(WIDTH-3, e.x -2 + (rand()%7)));
-              bombs.emplace_back(bx, e.y+2, 1);
-            }
-          }
-          // reset cooldown (shorter in strong phase)
-          e.skillCooldown = strongPhase ? 30 : 50;
-        }
+        if (e.skillCooldown <= 0) due.push_back(i);
         break;
-      }
     }
   }
+}
+
+// a boss uses a skill: laser sweep or bomb rain
+void bossSkill(Enemy &e) {
+  // choose skill
+  int r = gameRand()%100;
+  bool strongPhase = (e.hp <= ( (20 + level*5) / 2 ));
+  if (r < 45) {
+    // laser
+    laser.active = true;
+    laser.y = e.y + 2; // sweep a row below boss
+    laser.life = strongPhase ? 10 : 6;
+  } else {
+    // bomb rain: spawn several bombs below boss
+    int count = strongPhase ? 8 : 5;
+    for (int b=0;b<count;b++) {
+      int bx = max(2, min(WIDTH-3, e.x -2 + (gameRand()%7)));
+      bombs.emplace_back(bx, e.y+2, 1);
+    }
+  }
+  // reset cooldown (shorter in strong phase)
+  e.skillCooldown = strongPhase ? 30 : 50;
+}
+
+// movement pass: timers, bullets, bombs, enemy AI and spawning
+void updateMovement() {
+  // decrease power-up timers
+  if (rapidFireTimer > 0) rapidFireTimer--;
+  if (damageBoostTimer > 0) damageBoostTimer--;
+
+  // move bullets
+  for (auto &b: bullets) b.y += b.dy;
+  bullets.erase(remove_if(bullets.begin(), bullets.end(),
+    [](const Bullet &b){ return b.y < 1 || b.y >= HEIGHT-1; }), bullets.end());
+
+  // move bombs (boss bombs falling)
+  for (auto &bm: bombs) bm.y += bm.dy;
+  bombs.erase(remove_if(bombs.begin(), bombs.end(),
+    [](const Bomb &b){ return b.y >= HEIGHT-1; }), bombs.end());
+
+  // enemy AI, in chunks on the pool; skills that bosses are due to use run
+  // afterwards in enemy order, which keeps gameRand() draws in serial order
+  EnemyStep st;
+  st.enemies = enemies.data();
+  st.tanks = players;
+  st.tankCount = playerCount;
+  st.tick = tickCount;
+  st.globalDelay = max(2, 10 - level/2);
+  int n = (int)enemies.size();
+  int chunks = min(POOL_FOR_CHUNKS, max(1, (n + ENEMY_CHUNK - 1) / ENEMY_CHUNK));
+  int per = (n + chunks - 1) / chunks;
+  static thread_local vector<int> skillDue[POOL_FOR_CHUNKS];  // per chunk: bosses whose skill is due
+  if (skillDue[0].capacity() == 0) for (auto &d: skillDue) d.reserve(16);
+  vector<int> *due = skillDue;  // the world is per thread: chunks only see what is passed in
+  poolFor(chunks, 1, [&st, due, n, per](int lo, int hi) {
+    for (int c=lo; c<hi; c++) moveEnemies(st, c * per, min(n, (c + 1) * per), due[c]);
+  });
+  for (int c=0;c<chunks;c++) {
+    for (int i: due[c]) bossSkill(enemies[i]);
+    due[c].clear();
+  }
 
   // spawn
-  if (tickCount % max(8, enemySpawnRate - level*3) == 0)
+  if (swarm) {
+    for (int i=0;i<SWARM_WAVES;i++) spawnEnemiesByLevel();
+  } else if (tickCount % max(8, enemySpawnRate - level*3) == 0) {
     spawnEnemiesByLevel();
+  }
+}
 
+// collision pass; returns false when the game ended this tick
+bool updateCollisions() {
   // collisions: bullets vs enemies and boss interactions
-  vector<int> rmB, rmE;
+  static thread_local vector<int> rmB, rmE;  // kept across ticks to reuse their capacity
+  if (rmB.capacity() == 0) { rmB.reserve(256); rmE.reserve(256); }
+  rmB.clear(); rmE.clear();
   for (int i=0;i<(int)bullets.size();++i) {
     for (int j=0;j<(int)enemies.size();++j) {
       if (abs(bullets[i].x - enemies[j].x) <= 1 && abs(bullets[i].y - enemies[j].y) <= 1) {
@@ -554,6 +1830,7 @@ void updateGameLogic() {
           maybeDropItem(enemies[j].x, enemies[j].y);
           rmE.push_back(j);
           score += 10;
+          players[bullets[i].owner].score += 10;
           explosions.emplace_back(enemies[j].x, enemies[j].y, EXPLOSION_FRAMES);
         }
       }
@@ -566,19 +1843,34 @@ void updateGameLogic() {
   for (int i: rmB) if (i < (int)bullets.size()) bullets.erase(bullets.begin()+i);
   for (int j: rmE) if (j < (int)enemies.size()) enemies.erase(enemies.begin()+j);
 
-  // handle bombs hitting player or ground
+  // versus: bullets hit the other tank
+  if (versus) {
+    for (int i = (int)bullets.size()-1; i>=0; --i) {
+      Bullet &b = bullets[i];
+      for (int p=0;p<playerCount;p++) {
+        Tank &t = players[p];
+        if (p == b.owner || !t.alive || abs(b.x - t.x) > 1 || abs(b.y - t.y) > 1) continue;
+        explosions.emplace_back(t.x, t.y, EXPLOSION_FRAMES/2);
+        players[b.owner].score += 50;
+        bullets.erase(bullets.begin()+i);
+        if (t.shieldCount > 0) t.shieldCount--;
+        else if (!killTank(t)) return false;
+        break;
+      }
+    }
+  }
+
+  // handle bombs hitting a tank or ground
   for (int bi = (int)bombs.size()-1; bi>=0; --bi) {
     Bomb &bm = bombs[bi];
-    // if bomb hits player
-    if (abs(bm.x - player.x) <= 0 && abs(bm.y - player.y) <= 1) {
-      if (player.shieldCount > 0) {
-        player.shieldCount--;
-        explosions.emplace_back(player.x, player.y, EXPLOSION_FRAMES);
-      } else {
-        explosions.emplace_back(player.x, player.y, EXPLOSION_FRAMES);
-        running = false;
-        return;
-      }
+    // if bomb hits a tank
+    Tank *hit = nullptr;
+    for (int p=0;p<playerCount && !hit;p++)
+      if (players[p].alive && abs(bm.x - players[p].x) <= 0 && abs(bm.y - players[p].y) <= 1) hit = &players[p];
+    if (hit) {
+      explosions.emplace_back(hit->x, hit->y, EXPLOSION_FRAMES);
+      if (hit->shieldCount > 0) hit->shieldCount--;
+      else if (!killTank(*hit)) return false;
       bombs.erase(bombs.begin()+bi);
       continue;
     }
@@ -596,12 +1888,15 @@ void updateGameLogic() {
     // decrement life
     it.life--;
     if (it.life <= 0) { items.erase(items.begin()+ii); continue; }
-    // pickup if player overlaps
-    if (abs(it.x - player.x) <= 1 && abs(it.y - player.y) <= 1) {
+    // pickup if a tank overlaps
+    Tank *taker = nullptr;
+    for (int p=0;p<playerCount && !taker;p++)
+      if (players[p].alive && abs(it.x - players[p].x) <= 1 && abs(it.y - players[p].y) <= 1) taker = &players[p];
+    if (taker) {
       if (it.t == IT_HEALTH) {
-        player.hp = min(player.hp + 1, 12);
+        taker->hp = min(taker->hp + 1, 12);
       } else if (it.t == IT_SHIELD) {
-        player.shieldCount++;
+        taker->shieldCount++;
       } else if (it.t == IT_RAPID) {
         rapidFireTimer = 600; // e.g. 600 ticks ~ 24s at 40ms/frame
       } else if (it.t == IT_DAMAGE) {
@@ -616,18 +1911,18 @@ void updateGameLogic() {
   explosions.erase(remove_if(explosions.begin(), explosions.end(),
     [](const Explosion &e){ return e.life <= 0; }), explosions.end());
 
-  // laser active effects - damage player if on laser row
+  // laser active effects - damage tanks on laser row
   if (laser.active) {
     if (laser.life > 0) {
-      // if player in row, damage
-      if (abs(player.y - laser.y) <= 0) {
-        if (player.shieldCount > 0) {
-          player.shieldCount--;
-          explosions.emplace_back(player.x, player.y, EXPLOSION_FRAMES/2);
+      for (int p=0;p<playerCount;p++) {
+        Tank &t = players[p];
+        if (!t.alive || abs(t.y - laser.y) > 0) continue;
+        if (t.shieldCount > 0) {
+          t.shieldCount--;
+          explosions.emplace_back(t.x, t.y, EXPLOSION_FRAMES/2);
         } else {
-          explosions.emplace_back(player.x, player.y, EXPLOSION_FRAMES);
-          running = false;
-          return;
+          explosions.emplace_back(t.x, t.y, EXPLOSION_FRAMES);
+          if (!killTank(t)) return false;
         }
       }
       laser.life--;
@@ -636,28 +1931,33 @@ void updateGameLogic() {
     }
   }
 
-  // player collision with enemies (immediate end or shield)
+  // tank collision with enemies (tank destroyed or shield)
   for (int idx = (int)enemies.size()-1; idx >= 0; --idx) {
     Enemy &e = enemies[idx];
     int thresh = (e.type==STRONG)?3:2;
     if (e.type==BOSS) thresh = 4;
-    if (abs(e.x - player.x) <= thresh && abs(e.y - player.y) <= thresh) {
-      if (player.shieldCount > 0) {
-        player.shieldCount--;
-        explosions.emplace_back(e.x, e.y, EXPLOSION_FRAMES);
-        explosions.emplace_back(player.x, player.y, EXPLOSION_FRAMES/2);
+    for (int p=0;p<playerCount;p++) {
+      Tank &t = players[p];
+      if (!t.alive || abs(e.x - t.x) > thresh || abs(e.y - t.y) > thresh) continue;
+      explosions.emplace_back(e.x, e.y, EXPLOSION_FRAMES);
+      if (t.shieldCount > 0) {
+        t.shieldCount--;
+        explosions.emplace_back(t.x, t.y, EXPLOSION_FRAMES/2);
         enemies.erase(enemies.begin() + idx);
         score += 5;
-        continue;
+        t.score += 5;
       } else {
-        explosions.emplace_back(e.x, e.y, EXPLOSION_FRAMES);
-        explosions.emplace_back(player.x, player.y, EXPLOSION_FRAMES);
-        running = false;
-        return;
+        explosions.emplace_back(t.x, t.y, EXPLOSION_FRAMES);
+        if (!killTank(t)) return false;
       }
+      break;
     }
   }
+  return true;
+}
 
+// cleanup pass: drop off-screen enemies, level up
+void updateCleanup() {
   // remove enemies that passed bottom
   enemies.erase(remove_if(enemies.begin(), enemies.end(),
     [](const Enemy &e){ return e.y >= HEIGHT-3; }), enemies.end());
@@ -665,243 +1965,3171 @@ void updateGameLogic() {
   // level up
   if (score >= level * 200) {
     level++;
-    player.hp = min(player.hp + 1, 12);
+    for (int i=0;i<playerCount;i++)
+      if (players[i].alive) players[i].hp = min(players[i].hp + 1, 12);
     for (int i=0;i<2;i++) spawnEnemiesByLevel();
     // spawn boss on medium/hard handled elsewhere; here spawn occasional boss
     if (level % 3 == 0) spawnBoss();
   }
 }
 
-// ---------- Rendering ----------
-string buildOutputBuffer(const vector<string> &scr) {
-  // Count enemy types for HUD
-  int cntNormal=0,cntFast=0,cntStrong=0,cntBouncer=0,cntZig=0,cntChaser=0,cntBoss=0;
-  for (auto &e: enemies) {
-    switch (e.type) {
-      case NORMAL: cntNormal++; break;
-      case FAST: cntFast++; break;
-      case STRONG: cntStrong++; break;
-      case BOUNCER: cntBouncer++; break;
-      case ZIGZAG: cntZig++; break;
-      case CHASER: cntChaser++; break;
-      case BOSS: cntBoss++; break;
+void updateGameLogic() {
+  TraceScope ts("updateGameLogic");
+  tickCount++;
+  bool alive;
+  { PhaseScope ps(PH_MOVE); updateMovement(); }
+  { PhaseScope ps(PH_COLLIDE); alive = updateCollisions(); }
+  if (alive) { PhaseScope ps(PH_CLEANUP); updateCleanup(); }
+  worldHash = hashWorld();
+}
+
+// ---------- Frame encoder ----------
+// A row is classified into attribute ids, then emitted as runs: each run of
+// equal attributes is at most one color escape and one memcpy'd span.
+// Run ends are found 16 (SSE2) or 32 (AVX2) cells at a time, picked at
+// startup from the CPU, with a scalar fallback elsewhere.
+const int ATTR_ROW_PAD = 32;  // lets vector loads run past the row end
+
+// first index >= i+1 whose attribute differs from a[i]; a[n] is a sentinel
+int runEndScalar(const uint8_t *a, int i, int n) {
+  uint8_t v = a[i];
+  int j = i + 1;
+  while (j < n && a[j] == v) j++;
+  return j;
+}
+
+#if defined(TANK_X86_SIMD)
+__attribute__((target("sse2")))
+int runEndSSE2(const uint8_t *a, int i, int n) {
+  __m128i v = _mm_set1_epi8((char)a[i]);
+  for (int j=i+1; j<n; j+=16) {
+    __m128i blk = _mm_loadu_si128((const __m128i*)(a + j));
+    unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(blk, v)) & 0xFFFFu;
+    if (diff) return min(n, j + __builtin_ctz(diff));
+  }
+  return n;
+}
+
+__attribute__((target("avx2")))
+int runEndAVX2(const uint8_t *a, int i, int n) {
+  __m256i v = _mm256_set1_epi8((char)a[i]);
+  for (int j=i+1; j<n; j+=32) {
+    __m256i blk = _mm256_loadu_si256((const __m256i*)(a + j));
+    unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(blk, v));
+    if (diff) return min(n, j + __builtin_ctz(diff));
+  }
+  return n;
+}
+#endif
+
+struct RunEncoder { const char *name; int (*runEnd)(const uint8_t*, int, int); };
+const RunEncoder RUN_ENCODERS[] = {
+  {"scalar", runEndScalar},
+#if defined(TANK_X86_SIMD)
+  {"sse2", runEndSSE2},
+  {"avx2", runEndAVX2},
+#endif
+};
+const int RUN_ENCODER_COUNT = sizeof(RUN_ENCODERS) / sizeof(RUN_ENCODERS[0]);
+const RunEncoder *runEncoder = &RUN_ENCODERS[0];
+
+bool runEncoderSupported(const RunEncoder &e) {
+#if defined(TANK_X86_SIMD)
+  if (e.runEnd == runEndAVX2) return __builtin_cpu_supports("avx2");
+  if (e.runEnd == runEndSSE2) return __builtin_cpu_supports("sse2");
+#endif
+  return e.runEnd == runEndScalar;
+}
+
+// sse2 by default, or the named one (--encoder=NAME). avx2 is opt-in: with
+// 100-column rows it measured no faster than sse2 (--bench-encode), and
+// its wider loads can cost a clock drop on some CPUs
+bool selectRunEncoder(const string &name) {
+  string want = name.empty() ? "sse2" : name;
+  for (int i=0; i<RUN_ENCODER_COUNT; i++) {
+    if (want == RUN_ENCODERS[i].name && runEncoderSupported(RUN_ENCODERS[i])) { runEncoder = &RUN_ENCODERS[i]; return true; }
+  }
+  if (!name.empty()) return false;
+  runEncoder = &RUN_ENCODERS[0];  // scalar: no sse2 on this target
+  return true;
+}
+
+// ---------- Diff renderer ----------
+// The terminal keeps what it was sent, so a frame only carries the cells
+// that differ from what is on screen. termShown models the screen once the
+// frame being written (if any) is done; new frames are diffed against it.
+// A queued frame that gets replaced was never shown, so its replacement is
+// diffed against the same base and dropping frames stays safe.
+struct TermModel {
+  char cell[HEIGHT][WIDTH];
+  uint8_t attr[HEIGHT][WIDTH];
+  string tail;  // HUD and overlay lines below the arena
+  const uint8_t *lut = nullptr;  // glyph table the attributes came from
+  int lutKind = -1;
+  bool ovr[HEIGHT];              // rows colored through an AttrPlane
+  int scroll = 0;                // starScroll the arena was drawn at
+  bool valid = false;
+};
+// the three roles rotate by pointer swaps, so presenting a frame copies nothing
+TermModel termModels[3];
+TermModel *termShown = &termModels[0];   // on screen once the current write ends
+TermModel *termFrame = &termModels[1];   // just encoded
+TermModel *termQueued = &termModels[2];  // waiting behind the current write
+
+// row/col -1: unknown (frame start, or past the last column); attr -1: unknown SGR
+struct Cursor { int row = -1, col = -1, attr = -1; };
+
+const int GAP_REPRINT_MAX = 8;  // longest clean gap worth reprinting instead of moving
+// The starfield moves the whole arena interior down a row at a time. Rather
+// than repaint every star, the terminal scrolls that band itself (DECSTBM
+// margins plus reverse index) and the model is shifted to match, so only the
+// sprites, far stars and the exposed top row show up as dirty cells.
+const int SCROLL_TOP = 1, SCROLL_BOTTOM = HEIGHT - 2;
+const int SCROLL_MAX = 3;  // larger jumps are cheaper as plain diffs
+
+int decDigits(int v) { return v >= 100 ? 3 : v >= 10 ? 2 : 1; }
+
+void appendNum(string &out, int v) {
+  char buf[12];
+  out.append(buf, snprintf(buf, sizeof(buf), "%d", v));
+}
+
+const string &attrSgr(int a) { return a == A_PLAIN ? COL_RESET : attrColor[a]; }
+int sgrCost(int from, int to) { return from == to ? 0 : (int)attrSgr(to).size(); }
+
+// bytes for a relative horizontal move (CUF/CUB)
+int horzCost(int from, int to) {
+  int n = abs(to - from);
+  return n == 0 ? 0 : 3 + (n > 1 ? decDigits(n) : 0);
+}
+
+void emitHorz(string &out, int from, int to) {
+  if (from == to) return;
+  out += "\x1B[";
+  if (abs(to - from) > 1) appendNum(out, abs(to - from));
+  out.push_back(to > from ? 'C' : 'D');
+}
+
+// moves the cursor to (row, col) by the cheapest of absolute CUP, relative
+// CUF/CUB, CR, or CR plus line feeds; returns the byte cost and emits the
+// move only when out is given
+int cursorTo(Cursor &cur, int row, int col, string *out) {
+  if (cur.row == row && cur.col == col) return 0;
+  enum { MV_CUP, MV_HORZ, MV_CR, MV_LF } how = MV_CUP;
+  int best = 3 + decDigits(row + 1) + (col ? 1 + decDigits(col + 1) : 0);
+  if (cur.row == row && cur.col >= 0 && horzCost(cur.col, col) < best) { how = MV_HORZ; best = horzCost(cur.col, col); }
+  if (cur.row == row && 1 + horzCost(0, col) < best) { how = MV_CR; best = 1 + horzCost(0, col); }
+  if (cur.row >= 0 && row > cur.row && 1 + (row - cur.row) + horzCost(0, col) < best) {
+    how = MV_LF;
+    best = 1 + (row - cur.row) + horzCost(0, col);
+  }
+  if (!out) return best;
+  switch (how) {
+    case MV_CUP:
+      *out += "\x1B[";
+      appendNum(*out, row + 1);
+      if (col) { out->push_back(';'); appendNum(*out, col + 1); }
+      out->push_back('H');
+      break;
+    case MV_HORZ: emitHorz(*out, cur.col, col); break;
+    case MV_CR: out->push_back('\r'); emitHorz(*out, 0, col); break;
+    case MV_LF: out->push_back('\r'); out->append(row - cur.row, '\n'); emitHorz(*out, 0, col); break;
+  }
+  cur.row = row;
+  cur.col = col;
+  return best;
+}
+
+// writes cells [from, to) of a row as attribute runs
+void emitCells(const char *row, const uint8_t *attr, int from, int to, Cursor &cur, string &out) {
+  for (int i=from; i<to; ) {
+    int j = runEncoder->runEnd(attr, i, to);
+    if (attr[i] != cur.attr) { out += attrSgr(attr[i]); cur.attr = attr[i]; }
+    const string &glyph = attrGlyph[attr[i]];
+    if (glyph.empty()) out.append(row + i, j - i);
+    else for (int k=i; k<j; k++) out += glyph;
+    i = j;
+  }
+  cur.col = to < WIDTH ? to : -1;  // at the edge the wrap state depends on the terminal
+}
+
+// reaches column x of row y, reprinting the clean cells in between when that
+// is cheaper than a cursor move plus the SGR the move would still need
+void reachCell(int y, int x, const char *row, const uint8_t *attr, Cursor &cur, string &out) {
+  if (cur.row == y && cur.col >= 0 && cur.col < x && x - cur.col <= GAP_REPRINT_MAX) {
+    int a = cur.attr, gap = 0;
+    for (int i=cur.col; i<x; i++) {
+      gap += sgrCost(a, attr[i]) + max<int>(1, attrGlyph[attr[i]].size());
+      a = attr[i];
     }
+    gap += sgrCost(a, attr[x]);
+    int move = cursorTo(cur, y, x, nullptr) + sgrCost(cur.attr, attr[x]);
+    if (gap < move) { emitCells(row, attr, cur.col, x, cur, out); return; }
   }
+  cursorTo(cur, y, x, &out);
+}
 
-  string out;
-  out.reserve(WIDTH * HEIGHT + 512);
+// Half-block mode composes the arena on a WIDTH x 2*HEIGHT pixel plane,
+// then packs each vertical pixel pair into one ▀/▄/█ cell with fg/bg
+// colors. Stars are single pixels stepping half a row per tick, twice as
+// smooth as the cell grid. Glyphs go over them and fill the top, bottom or
+// both pixels of their cell, so what a '^' or '_' leaves free still shows.
+// Explosions burn hotter on top. It works from the glyph screen, so
+// spectators and replays get it too.
+uint8_t halfPix[2*HEIGHT][WIDTH];                // color per pixel, A_PLAIN = empty
+vector<string> halfCells = createEmptyScreen();  // text glyphs; ' ' where the style carries a block
+AttrPlane halfPlane;                             // packed style of every cell
+
+// style for a pair of pixel colors; a full attribute table falls back to
+// the top color's full block
+uint8_t halfPairAttr(int top, int bottom) {
+  uint8_t &a = halfPair[top][bottom];
+  if (a == A_PLAIN && top != A_PLAIN && bottom != A_PLAIN)
+    a = attrCount < ATTR_MAX ? halfAttr(top, bottom, false) : halfPair[top][top];
+  return a;
+}
+
+// fills halfCells and halfPlane from the arena glyphs and overrides
+void packHalfBlocks(const vector<string> &scr, const AttrPlane &ovr) {
+  const uint8_t *lut = cellAttr[LUT_COLOR][animEffects && (tickCount/2)%2 != 0];
+  memset(halfPix, 0, sizeof(halfPix));
+  if (starsInFrame) {
+    // the near layer moves a row every two ticks, so on odd ticks it is half a row further
+    int nearPhase = animEffects ? tickCount & 1 : 0, farPhase = starScroll & 1;
+    for (int y=1;y<HEIGHT-1;y++)
+      forEachStar(y, [y, nearPhase, farPhase](int x, char c) {
+        halfPix[2*y + (c == '.' ? nearPhase : farPhase)][x] = cellAttr[LUT_COLOR][0][(unsigned char)c];
+      });
+  }
   for (int y=0;y<HEIGHT;y++) {
+    const char *row = scr[y].data();
+    char *cells = &halfCells[y][0];
+    uint8_t *top = halfPix[2*y], *bottom = halfPix[2*y+1], *style = halfPlane.a[y];
+    bool any = false;
     for (int x=0;x<WIDTH;x++) {
-      char ch = scr[y][x];
-      if (ch == '*') {
-        if ((tickCount/2)%2==0) out += COL_EXP1 + "*" + colorReset();
-        else out += COL_EXP2 + "*" + colorReset();
+      unsigned char c = row[x];
+      cells[x] = ' ';
+      if (c == '*') {
+        uint8_t o = ovr.row[y] ? ovr.a[y][x] : 0;
+        top[x] = o ? o : lut[c];
+        bottom[x] = o ? expBelow[o] : (uint8_t)(lut[c] == A_EXP ? A_RED : A_EXP);
+      } else if (halfMask[c] == HM_TEXT) {
+        cells[x] = c;
+        style[x] = halfText[lut[c]];
+        any |= style[x] != A_PLAIN;
+        continue;
+      } else {
+        if (halfMask[c] & HM_TOP) top[x] = lut[c];
+        if (halfMask[c] & HM_BOTTOM) bottom[x] = lut[c];
       }
-      else if (ch == '#') out += fgColor(91) + "#" + colorReset();
-      else if (ch == '/' || ch == '\\' || ch == '_' || ch == '^') out += fgColor(95) + string(1,ch) + colorReset();
-      else if (ch == '+' || ch == '-' || ch == '+' || ch == '+') out += fgColor(34) + string(1,ch) + colorReset();
-      else if (ch == '=') out += fgColor(93) + "=" + colorReset();
-      else if (ch == '&') out += fgColor(93) + "&" + colorReset();
-      else if (ch == 'Z') out += fgColor(96) + "Z" + colorReset();
-      else if (ch == 'C') out += fgColor(95) + "C" + colorReset();
-      else if (ch == '+' || ch == '+') out += fgColor(35) + string(1,ch) + colorReset();
-      else if (ch == 'o') out += fgColor(91) + "o" + colorReset();
-      else if (ch == 'S' || ch == '+' || ch == 'R' || ch == 'D') out += fgColor(93) + string(1,ch) + colorReset();
-      else if (ch == '|' ) out += COL_BULLET + "|" + colorReset();
-      else if (ch == '-' ) out += fgColor(95) + "-" + colorReset();
-      else if (ch == ':' ) out += fgColor(97) + ":" + colorReset();
-      else if (ch == '!' ) out += fgColor(93) + "!" + colorReset();
-      else if (ch == 'O' || ch == 'o') out += fgColor(36) + string(1,ch) + colorReset();
-      else if (ch == 'O') out += fgColor(36) + "O" + colorReset();
-      else if (ch == '|' || ch == '-') out += COL_BORDER + ch + colorReset();
-      else out.push_back(ch);
+      style[x] = halfPairAttr(top[x], bottom[x]);
+      any |= style[x] != A_PLAIN;
     }
-    out.push_back('\n');
+    halfPlane.row[y] = any;
   }
+}
 
-  // HUD line: power-ups / timers
-  string active = "";
-  if (rapidFireTimer > 0) {
-    active += "RapidFire(" + to_string(rapidFireTimer/25) + "s) ";
-  }
-  if (damageBoostTimer > 0) {
-    active += "Damage++(" + to_string(damageBoostTimer/25) + "s) ";
-  }
-  if (player.shieldCount > 0) {
-    active += "Shield:" + to_string(player.shieldCount) + " ";
-  }
-
-  out += COL_TEXT + string(" Tank: ") + player.type +
-         " | Score: " + to_string(score) +
-         " | HP: " + to_string(player.hp) +
-         " | " + (active.empty()? "No PowerUps": active) +
-         " | Level: " + to_string(level) +
-         " | Enemies: " + to_string((int)enemies.size())
-         + " (N:" + to_string(cntNormal)
-         + " F:" + to_string(cntFast)
-         + " S:" + to_string(cntStrong)
-         + " B:" + to_string(cntBouncer)
-         + " Z:" + to_string(cntZig)
-         + " C:" + to_string(cntChaser)
-         + " Boss:" + to_string(cntBoss)
-         + ")   (W/A/S/D move, Space shoot, Q quit)"
-         + colorReset() + "\n";
-
-  return out;
-}
-
-void renderScreen() {
-  auto scr = createEmptyScreen();
-  drawBorder(scr);
-  // draw items, bombs, laser first so they appear behind explosions/tank if overlap
-  drawItems(scr);
-  drawBombs(scr);
-  drawLaser(scr);
-  for (auto &e: enemies) drawEnemyShape(scr, e);
-  for (auto &b: bullets) drawBulletShape(scr, b);
-  drawExplosions(scr);
-  drawTankShape(scr, player);
+// appends the bytes turning base into this frame: dirty cell spans of the
+// arena, then the HUD/overlay tail (next.tail) if it changed; fills next
+void encodeFrame(const vector<string> &arena, const AttrPlane &arenaAttr, const TermModel &base, TermModel &next, string &out) {
+  static const string blankCells(WIDTH, ' ');
+  static const uint8_t blankAttr[WIDTH] = {};
+  Cursor cur;
+  if (!base.valid) out += "\x1B[2J";
+  int shift = base.valid ? next.scroll - base.scroll : 0;
+  if (shift < 1 || shift > SCROLL_MAX) shift = 0;
+  if (shift) {
+    out += "\x1B[";
+    appendNum(out, SCROLL_TOP + 1);
+    out.push_back(';');
+    appendNum(out, SCROLL_BOTTOM + 1);
+    out += "r\x1B[";  // setting margins homes the cursor; go to the top margin
+    appendNum(out, SCROLL_TOP + 1);
+    out.push_back('H');
+    for (int i=0;i<shift;i++) out += "\x1BM";
+    out += "\x1B[r";
+  }
+  int lutKind = !colorOutput ? LUT_MONO : halfBlocks ? LUT_HALF : LUT_COLOR;
+  const uint8_t *lut = cellAttr[lutKind][animEffects && (tickCount/2)%2 != 0];
+  // half blocks encode the packed pixel plane in place of the glyphs
+  if (lutKind == LUT_HALF) packHalfBlocks(arena, arenaAttr);
+  const vector<string> &scr = lutKind == LUT_HALF ? halfCells : arena;
+  const AttrPlane &ovr = lutKind == LUT_HALF ? halfPlane : arenaAttr;
+  // the two flicker phases only disagree on '*', so rows without one keep their attributes
+  bool sameLut = base.lutKind == lutKind;
+  next.lut = lut;
+  next.lutKind = lutKind;
+  // Rows are prepared first (new model, attributes, dirty cells), then
+  // emitted in order since the cursor and SGR state carry from row to row.
+  static uint8_t rowAttr[HEIGHT][WIDTH + ATTR_ROW_PAD], rowDirty[HEIGHT][WIDTH + ATTR_ROW_PAD];
+  static bool rowEmit[HEIGHT];
+  for (int y=0;y<HEIGHT;y++) {
+    const char *row = scr[y].data();
+    const char *oc = base.cell[y];
+    const uint8_t *oa = base.attr[y];
+    bool oldOvr = base.ovr[y];
+    if (shift && y >= SCROLL_TOP && y <= SCROLL_BOTTOM) {
+      bool exposed = y - shift < SCROLL_TOP;
+      oc = exposed ? blankCells.data() : base.cell[y - shift];
+      oa = exposed ? blankAttr : base.attr[y - shift];
+      oldOvr = !exposed && base.ovr[y - shift];
+    }
+    bool overridden = lutKind != LUT_MONO && ovr.row[y];
+    next.ovr[y] = overridden;
+    memcpy(next.cell[y], row, WIDTH);
+    rowEmit[y] = !(base.valid && !overridden && !oldOvr && memcmp(oc, row, WIDTH) == 0 &&
+                   (base.lut == lut || (sameLut && !memchr(row, '*', WIDTH))));
+    if (!rowEmit[y]) {
+      memcpy(next.attr[y], oa, WIDTH);
+      continue;
+    }
+    uint8_t *attr = rowAttr[y], *dirty = rowDirty[y];
+    memset(attr + WIDTH, 0xFF, ATTR_ROW_PAD);
+    memset(dirty + WIDTH, 0xFF, ATTR_ROW_PAD);
+    for (int x=0;x<WIDTH;x++) attr[x] = lut[(unsigned char)row[x]];
+    if (overridden)
+      for (int x=0;x<WIDTH;x++)
+        if (uint8_t o = ovr.a[y][x]) attr[x] = o;
+    memcpy(next.attr[y], attr, WIDTH);
+    // dirty and clean spans are runs too, so the same scanner splits them
+    if (base.valid) for (int x=0;x<WIDTH;x++) dirty[x] = (oc[x] != row[x]) | (oa[x] != attr[x]);
+    else memset(dirty, 1, WIDTH);
+  }
+  for (int y=0;y<HEIGHT;y++) {
+    if (!rowEmit[y]) continue;
+    const char *row = scr[y].data();
+    const uint8_t *attr = rowAttr[y], *dirty = rowDirty[y];
+    for (int x=0; x<WIDTH; ) {
+      int end = runEncoder->runEnd(dirty, x, WIDTH);
+      if (dirty[x]) {
+        reachCell(y, x, row, attr, cur, out);
+        emitCells(row, attr, x, end, cur, out);
+      }
+      x = end;
+    }
+  }
+
+  // the HUD can wrap on narrow terminals, so the tail is rewritten as a
+  // whole from its first row whenever any of it changed
+  if (!base.valid || next.tail != base.tail) {
+    cursorTo(cur, HEIGHT, 0, &out);
+    if (cur.attr != A_PLAIN) out += COL_RESET;
+    for (size_t pos=0; pos<next.tail.size(); ) {
+      size_t nl = next.tail.find('\n', pos);
+      if (nl == string::npos) nl = next.tail.size();
+      out.append(next.tail, pos, nl - pos);
+      out += "\x1B[K\r\n";
+      pos = nl + 1;
+    }
+    out += "\x1B[J";
+  }
+  next.valid = true;
+}
+
+// ---------- Plain and binary frames ----------
+// When stdout is not a terminal (a pipe, a log file, CI) or TERM=dumb, escape
+// codes are wasted bytes. Both modes write only the spans of the arena that
+// changed since the last frame, and the HUD when it changed. Plain is text:
+//   @tick [full]         frame marker; full = redrawn from a blank arena
+//   y x glyphs           a changed span, in arena coordinates
+//   > line               each HUD/overlay line, escapes removed
+// Binary packs the same:
+//   "TKF" u8 flags (1 = full frame, 2 = tail)  u32 tick  u16 spans
+//   spans x { u8 y, u8 x, u8 len, len glyph bytes }  [u16 tail length, tail text]
+// Integers are little-endian; the tail is the HUD/overlay text without escapes.
+enum OutputMode { OUT_ANSI, OUT_PLAIN, OUT_BINARY };
+const char *OUTPUT_MODE_NAMES[] = { "ansi", "plain", "binary" };
+OutputMode outputMode = OUT_ANSI;
 
-  string buffer = buildOutputBuffer(scr);
+OutputMode detectOutputMode() {
 #if defined(_WIN32) || defined(_WIN64)
-  if (gConsole == nullptr) gConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-  COORD origin = {0,0};
-  SetConsoleCursorPosition(gConsole, origin);
-  DWORD written = 0;
-  WriteConsoleA(gConsole, buffer.c_str(), (DWORD)buffer.size(), &written, NULL);
+  bool tty = _isatty(_fileno(stdout)) != 0;
 #else
-  cout << "\x1B[H" << buffer << flush;
+  bool tty = isatty(STDOUT_FILENO) != 0;
 #endif
+  const char *term = getenv("TERM");
+  return !tty || (term && strcmp(term, "dumb") == 0) ? OUT_PLAIN : OUT_ANSI;
 }
 
-// ---------- Menu ----------
-int chooseTank() {
-  cout << "\x1B[2J\x1B[H" << COL_TEXT;
-  cout << "===== CHOOSE YOUR TANK =====\n\n";
-  cout << "1. Standard    - HP:5  Speed:1  FireRate:6  (Balanced)\n";
-  cout << "2. Heavy       - HP:8  Speed:1  FireRate:8  (Armored)\n";
-  cout << "3. Light       - HP:3  Speed:2  FireRate:4  (Agile)\n";
-  cout << "4. Sniper      - HP:4  Speed:1  FireRate:9  (High damage, narrow)\n";
-  cout << "5. RapidFire   - HP:4  Speed:1  FireRate:2  (Very fast shooting)\n";
-  cout << "6. Plasma      - HP:6  Speed:1  FireRate:5  (Energy shots)\n\n";
-  cout << "Choose 1..6: " << colorReset();
-  int choice = 1;
-  while (!kb_hit()) this_thread::sleep_for(chrono::milliseconds(50));
-  choice = kb_get();
-  if (choice >= '1' && choice <= '6') return choice - '0';
-  return 1;
+// appends text with CSI sequences removed
+void appendStripped(string &out, const string &text) {
+  for (size_t i=0; i<text.size(); i++) {
+    if (text[i] != '\x1B') { out.push_back(text[i]); continue; }
+    if (i + 1 < text.size() && text[i+1] == '[') {
+      i += 2;
+      while (i < text.size() && !(text[i] >= 0x40 && text[i] <= 0x7E)) i++;
+    }
+  }
 }
 
-void showTitleScreen() {
-  cout << "\x1B[2J\x1B[H" << COL_TEXT;
-  cout << "=====================================\n";
-  cout << "        TANK SHOOTER - v5.0          \n";
-  cout << "    (PowerUps & Boss Skills added)   \n";
-  cout << "=====================================\n\n";
-  cout << "1. Start Game\n2. Instructions\n3. Tank & Enemy Info\n4. Quit\n\n";
-  cout << colorReset() << "Choose an option: ";
+// drops escape sequences on their way to the real stdout buffer, so menus
+// and the game-over screen print as plain text when frames are not ANSI
+struct StripEscBuf : streambuf {
+  streambuf *dst;
+  int state = 0;  // 0 text, 1 after ESC, 2 inside a CSI sequence
+  explicit StripEscBuf(streambuf *d) : dst(d) {}
+  int overflow(int c) override {
+    if (c == EOF) return 0;
+    if (state == 1) state = c == '[' ? 2 : 0;
+    else if (state == 2) state = c >= 0x40 && c <= 0x7E ? 0 : 2;
+    else if (c == 0x1B) state = 1;
+    else return dst->sputc((char)c);
+    return c;
+  }
+  int sync() override { return dst->pubsync(); }
+};
+
+void appendLE(string &out, uint64_t v, int bytes) {
+  for (int i=0;i<bytes;i++) out.push_back((char)(v >> (8*i)));
 }
 
-void showInstructions() {
-  cout << "\x1B[2J\x1B[H" << COL_TEXT;
-  cout << "Instructions:\n";
-  cout << "- Move with W/A/S/D.\n";
-  cout << "- Shoot with Space.\n";
-  cout << "- Avoid or destroy enemies before they hit you.\n";
-  cout << "- PowerUps drop from enemies sometimes (+ S R D)\n";
-  cout << "- Boss uses Laser (horizontal) and Bomb Rain.\n\n";
-  cout << "Press any key to return.\n" << colorReset();
-  while (!kb_hit()) this_thread::sleep_for(chrono::milliseconds(50));
-  kb_get();
+const int PLAIN_SPAN_GAP = 4;  // unchanged cells that end a span; fewer cost less to resend
+
+// like encodeFrame, but for OUT_PLAIN / OUT_BINARY; attributes are ignored
+void encodePlainFrame(const vector<string> &scr, const TermModel &base, TermModel &next, string &out) {
+  struct Span { uint8_t y, x, len; };
+  static Span spans[HEIGHT * (WIDTH / 2 + 1)];
+  int count = 0;
+  for (int y=0;y<HEIGHT;y++) {
+    const char *row = scr[y].data();
+    if (base.valid) {
+      const char *old = base.cell[y];
+      for (int x=0; x<WIDTH; ) {
+        while (x < WIDTH && old[x] == row[x]) x++;
+        if (x == WIDTH) break;
+        int s = x, e = x + 1;
+        for (int j=e; j<WIDTH && j - e < PLAIN_SPAN_GAP; j++)
+          if (old[j] != row[j]) e = j + 1;
+        spans[count++] = {(uint8_t)y, (uint8_t)s, (uint8_t)(e - s)};
+        x = e;
+      }
+    } else {
+      spans[count++] = {(uint8_t)y, 0, (uint8_t)WIDTH};
+    }
+    memcpy(next.cell[y], row, WIDTH);
+    memset(next.attr[y], A_PLAIN, WIDTH);
+    next.ovr[y] = false;
+  }
+  next.lut = nullptr;
+  next.lutKind = -1;
+  next.valid = true;
+  bool tailChanged = !base.valid || next.tail != base.tail;
+  if (count == 0 && !tailChanged) return;  // nothing new to show
+
+  static string tail;
+  tail.clear();
+  if (tailChanged) appendStripped(tail, next.tail);
+  if (outputMode == OUT_PLAIN) {
+    out.push_back('@');
+    appendNum(out, (int)tickCount);
+    if (!base.valid) out += " full";
+    out.push_back('\n');
+    for (int i=0;i<count;i++) {
+      appendNum(out, spans[i].y);
+      out.push_back(' ');
+      appendNum(out, spans[i].x);
+      out.push_back(' ');
+      out.append(scr[spans[i].y], spans[i].x, spans[i].len);
+      out.push_back('\n');
+    }
+    for (size_t pos=0; pos<tail.size(); ) {
+      size_t nl = tail.find('\n', pos);
+      if (nl == string::npos) nl = tail.size();
+      out += "> ";
+      out.append(tail, pos, nl - pos);
+      out.push_back('\n');
+      pos = nl + 1;
+    }
+    return;
+  }
+  out += "TKF";
+  out.push_back((char)((base.valid ? 0 : 1) | (tailChanged ? 2 : 0)));
+  appendLE(out, (uint32_t)tickCount, 4);
+  appendLE(out, (uint32_t)count, 2);
+  for (int i=0;i<count;i++) {
+    out.push_back((char)spans[i].y);
+    out.push_back((char)spans[i].x);
+    out.push_back((char)spans[i].len);
+    out.append(scr[spans[i].y], spans[i].x, spans[i].len);
+  }
+  if (tailChanged) {
+    size_t len = min<size_t>(tail.size(), 0xFFFF);
+    appendLE(out, len, 2);
+    out.append(tail, 0, len);
+  }
 }
 
-void showInfoScreen() {
-    cout << "\x1B[2J\x1B[H" << COL_TEXT;
-    cout << "==============================\n";
-    cout << "     TANK & ENEMY INFO       \n";
-    cout << "==============================\n\n";
+// ---------- Session recording ----------
+// --record=FILE saves the frame stream as an asciicast v2 file (play it with
+// asciinema). The game thread only copies each written frame into a bounded
+// ring of preallocated slots; a writer thread JSON-encodes whatever queued
+// and writes it in one batch every REC_BATCH_MS. A full ring (slow disk)
+// drops the frame instead of blocking. The player's terminal is not touched:
+// the encoder makes a second, full-redraw copy of the next frame just for
+// the recording, so playback never applies a diff to the wrong screen.
+const uint32_t REC_SLOTS = 128;
+const size_t REC_SLOT_BYTES = 16384;  // reserved per slot so copies do not allocate
+const int REC_BATCH_MS = 20;
+const int REC_COLS = 160, REC_ROWS = HEIGHT + 12;  // room for the HUD and overlay
 
-    cout << fgColor(93) << "TANK TYPES:\n" << colorReset();
-    cout << COL_TANK << "Standard " << colorReset() << "- '*' shape, balanced stats.\n";
-    cout << fgColor(91) << "Heavy     " << colorReset() << "- '#' tank, strong armor, slow speed.\n";
-    cout << fgColor(96) << "Light     " << colorReset() << "- '+' agile but fragile.\n";
-    cout << fgColor(95) << "Sniper    " << colorReset() << "- '^' narrow gun, high damage.\n";
-    cout << fgColor(93) << "RapidFire " << colorReset() << "- '=' barrel, fires very fast.\n";
-    cout << fgColor(35) << "Plasma    " << colorReset() << "- 'O' style, energy bullets.\n\n";
+struct RecSlot { int64_t ns; string bytes; };
+RecSlot recSlots[REC_SLOTS];
+atomic<uint32_t> recHead{0}, recTail{0};
+atomic<bool> recStop{false};
+FILE *recFile = nullptr;
+thread recThread;
+string recordPath;
+int64_t recStartNs = 0;
+long recFrames = 0, recDropped = 0;
+bool recSkipping = false;  // after a drop, until a full redraw is recorded
+bool recWait = false;      // headless: no frame deadline, so wait for room instead
+mutex recMutex;            // headless: the writer sleeps for frames, the game for room
+condition_variable recCv;
 
-    cout << fgColor(93) << "ENEMY TYPES:\n" << colorReset();
-    cout << fgColor(91) << "# Normal   " << colorReset() << "- Basic slow-moving target.\n";
-    cout << fgColor(95) << "/^\\ Fast   " << colorReset() << "- Moves quickly, low HP.\n";
-    cout << fgColor(34) << "+-+ Strong " << colorReset() << "- Tough armor, slower.\n";
-    cout << fgColor(93) << "& Bouncer  " << colorReset() << "- Moves side-to-side as it descends.\n";
-    cout << fgColor(96) << "Z Zigzag   " << colorReset() << "- Erratic movement pattern.\n";
-    cout << fgColor(95) << "C Chaser   " << colorReset() << "- Tracks and hunts player.\n";
-    cout << fgColor(35) << "BOSS       " << colorReset() << "- Large tank with Laser and Bomb skills.\n\n";
+// A FILE ending in .tkr records the arena itself instead of terminal bytes,
+// so a replay (--play) renders in whatever mode the viewer picks. Each frame
+// is the cell plane (all glyphs, then all attributes) XORed with the frame
+// before and run-length coded; every REC_KEY_TICKS a keyframe codes against
+// a blank arena. Stars are blanked out before the XOR and redrawn from the
+// scroll on replay, so the moving backdrop costs nothing. Integers are
+// little-endian, varints LEB128:
+//   header  "TKR" u8 version  u8 width  u8 height  u16 tick ms  u16 key ticks
+//   frame   u8 flags  varint tick  varint scroll (zigzag)  [u64 world hash]  (REC_F_HASH)
+//           varint n, n bytes of runs
+//           [varint tail length, varint n, n bytes of runs]  (REC_F_TAIL)
+//   runs    { varint unchanged bytes, varint n, n XOR bytes } ...
+// The tail is the HUD/overlay text as sent, XORed with the previous tail
+// (cut or zero-padded to the new length; keyframes against zeros).
+//   index   { u32 tick, u64 offset } per keyframe, u32 count, "TKRX"
+// Keyframes hold tick and scroll as-is, other frames the change since the one
+// before. The index is appended on close; a cut-short file is scanned instead.
+// Version 1 files predate the world hash and are still played.
+enum RecFormat { REC_CAST, REC_CELLS };
+RecFormat recFormat = REC_CAST;
+const int REC_KEY_TICKS = 250;  // 10 s: a seek decodes at most this many frames
+const int REC_PLANE = HEIGHT * WIDTH * 2;
+const int REC_HEADER_BYTES = 10;
+const int REC_VERSION = 2;
+enum RecFrameFlag { REC_F_KEY = 1, REC_F_FLICKER = 2, REC_F_STARS = 4, REC_F_TAIL = 8, REC_F_HASH = 16 };
+// attribute byte: 0 = the glyph's own color, 1..EXPLOSION_FRAMES = explosion
+// gradient step, plus REC_A_NOSTAR on a blank that covers a star
+const uint8_t REC_A_NOSTAR = 0x80;
+const int REC_RUN_GAP = 3;  // unchanged bytes that end a literal run
+struct RecKey { uint32_t tick; uint64_t offset; };
 
-    cout << fgColor(97) << "PowerUps (drop): + Health, S Shield, R RapidFire, D DamageBoost\n\n" << colorReset();
-    cout << "Press any key to return to menu..." << endl;
-    while (!kb_hit()) this_thread::sleep_for(chrono::milliseconds(50));
-    kb_get();
+uint8_t recPlanes[2][REC_PLANE];
+int recCur = 0;               // plane being built; the other is the last queued frame
+string recOut, recRuns, recPrevTail, recTailBase;
+vector<RecKey> recKeys;
+uint64_t recOffset = 0;       // file offset of the next queued frame
+long recLastTick = 0, recKeyTick = 0;
+int recLastScroll = 0;
+bool recHavePrev = false;
+
+void appendVarint(string &out, uint64_t v) {
+  while (v >= 0x80) { out.push_back((char)(v | 0x80)); v >>= 7; }
+  out.push_back((char)v);
 }
 
-// ---------- Game loop ----------
-void runGameLoop() {
-  bullets.clear(); enemies.clear(); explosions.clear(); items.clear(); bombs.clear();
-  score = 0; tickCount = 0; level = 1; enemySpawnRate = START_ENEMY_RATE;
-  running = true;
-  rapidFireTimer = 0; damageBoostTimer = 0;
+bool readVarint(const uint8_t *&p, const uint8_t *end, uint64_t &v) {
+  v = 0;
+  for (int shift=0; p < end && shift < 64; shift += 7) {
+    uint8_t b = *p++;
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
 
-  int choice = chooseTank();
-  if (choice == 1) player = Tank(WIDTH/2, HEIGHT-4, 5, "Standard", 1, 6, 1, 1, 0);
-  else if (choice == 2) player = Tank(WIDTH/2, HEIGHT-4, 8, "Heavy", 1, 8, 1, 1, 0);
-  else if (choice == 3) player = Tank(WIDTH/2, HEIGHT-4, 3, "Light", 2, 4, 1, 1, 0);
-  else if (choice == 4) player = Tank(WIDTH/2, HEIGHT-4, 4, "Sniper", 1, 9, 2, 1, 0);
-  else if (choice == 5) player = Tank(WIDTH/2, HEIGHT-4, 4, "RapidFire", 1, 2, 1, 1, 0);
-  else player = Tank(WIDTH/2, HEIGHT-4, 6, "Plasma", 1, 5, 1, 1, 0);
-
-  cout << "\x1B[?25l"; // hide cursor
-  spawnEnemiesByLevel();
+uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
 
-  while (running) {
-    auto frameStart = chrono::steady_clock::now();
-    processInputGameplay();
-    updateGameLogic();
-    renderScreen();
-    auto elapsed = chrono::duration_cast<chrono::milliseconds>(
-      chrono::steady_clock::now() - frameStart).count();
-    if (elapsed < FRAME_MS) this_thread::sleep_for(chrono::milliseconds(FRAME_MS - elapsed));
+// the bytes of cur that differ from base as runs; short unchanged gaps stay
+// inside a literal since a new run would cost more than they do
+void appendXorRuns(string &out, const uint8_t *cur, const uint8_t *base, int n) {
+  int i = 0;
+  while (true) {
+    int s = i;
+    while (s < n && cur[s] == base[s]) s++;
+    if (s == n) return;
+    int e = s + 1;
+    for (int j=e; j<n && j - e < REC_RUN_GAP; j++)
+      if (cur[j] != base[j]) e = j + 1;
+    appendVarint(out, s - i);
+    appendVarint(out, e - s);
+    for (int j=s; j<e; j++) out.push_back((char)(cur[j] ^ base[j]));
+    i = e;
   }
+}
 
-  cout << "\x1B[?25h"; // show cursor
-  cout << "\x1B[2J\x1B[H" << COL_TEXT;
-  cout << "\n?? GAME OVER ??\n\n";
-  cout << "Final Score: " << score << "\n";
-  cout << "Level Reached: " << level << "\n";
-  cout << "Press 'r' to restart or any key to return.\n";
-  while (!kb_hit()) this_thread::sleep_for(chrono::milliseconds(50));
-  int c = kb_get();
-  if (c == 'r' || c == 'R') runGameLoop();
+void appendJsonString(string &out, const char *p, size_t n) {
+  static const char HEX[] = "0123456789abcdef";
+  out.push_back('"');
+  for (size_t i=0;i<n;i++) {
+    unsigned char c = p[i];
+    if (c == '"' || c == '\\') { out.push_back('\\'); out.push_back(c); }
+    else if (c == '\n') out += "\\n";
+    else if (c == '\r') out += "\\r";
+    else if (c < 0x20 || c == 0x7F) { out += "\\u00"; out.push_back(HEX[c >> 4]); out.push_back(HEX[c & 15]); }
+    else out.push_back(c);
+  }
+  out.push_back('"');
 }
 
-// ---------- Main ----------
-int main() {
-  srand((unsigned)time(nullptr));
-  enableVTAndUTF8();
-  kb_init();
+// wakes the other side of the ring; taking the lock orders this after a
+// waiter's predicate check, so the wakeup cannot be lost
+void recNotify() {
+  { lock_guard<mutex> lk(recMutex); }
+  recCv.notify_all();
+}
 
+void recordThreadMain() {
+  tlsThreadName = "recorder";
+  string batch;
+  batch.reserve(1 << 20);
   while (true) {
+    bool stop = recStop.load(memory_order_acquire);
+    uint32_t t = recTail.load(memory_order_relaxed), h = recHead.load(memory_order_acquire);
+    uint32_t n = h - t;
+    for (; t != h; t++) {
+      const RecSlot &sl = recSlots[t % REC_SLOTS];
+      if (recFormat == REC_CELLS) { batch += sl.bytes; continue; }
+      char ts[32];
+      batch.append(ts, snprintf(ts, sizeof(ts), "[%.6f, \"o\", ", sl.ns / 1e9));
+      appendJsonString(batch, sl.bytes.data(), sl.bytes.size());
+      batch += "]\n";
+    }
+    recTail.store(t, memory_order_release);
+    if (recWait) recNotify();  // room for a waiting game thread
+    if (!batch.empty()) {
+      TraceScope ts("recordWrite");
+      fwrite(batch.data(), 1, batch.size(), recFile);
+      fflush(recFile);
+      batch.clear();
+    }
+    if (stop && t == recHead.load(memory_order_acquire)) break;
+    if (recWait) {
+      // headless: no point batching, sleep until the game queues a frame
+      unique_lock<mutex> lk(recMutex);
+      recCv.wait(lk, [t]{ return recStop.load(memory_order_acquire) || recHead.load(memory_order_acquire) != t; });
+    } else if (n < REC_SLOTS / 2) this_thread::sleep_for(chrono::milliseconds(REC_BATCH_MS));
+  }
+}
+
+bool recordOpen() {
+  recFile = fopen(recordPath.c_str(), "wb");
+  if (!recFile) return false;
+  if (recFormat == REC_CELLS) {
+    string hdr = "TKR";
+    hdr.push_back(REC_VERSION);
+    hdr.push_back((char)WIDTH);
+    hdr.push_back((char)HEIGHT);
+    appendLE(hdr, FRAME_MS, 2);
+    appendLE(hdr, REC_KEY_TICKS, 2);
+    fwrite(hdr.data(), 1, hdr.size(), recFile);
+    recOffset = hdr.size();
+    recKeys.reserve(4096);  // about 11 hours of keyframes
+    recOut.reserve(REC_SLOT_BYTES);
+    recRuns.reserve(REC_PLANE * 2);
+    recPrevTail.reserve(4096);
+    recTailBase.reserve(4096);
+  } else {
+    const char *term = getenv("TERM");
+    fprintf(recFile, "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %ld, \"idle_time_limit\": 2, "
+            "\"title\": \"Tank game\", \"env\": {\"TERM\": \"%s\"}}\n",
+            REC_COLS, REC_ROWS, (long)time(nullptr), term && !strchr(term, '"') ? term : "xterm-256color");
+  }
+  for (auto &sl: recSlots) sl.bytes.reserve(REC_SLOT_BYTES);
+  recStartNs = steadyNowNs();
+  recThread = thread(recordThreadMain);
+  return true;
+}
+
+// copies bytes into a free slot; false when the ring is full (never in headless)
+bool recordQueue(const string &bytes, int64_t ns) {
+  uint32_t h = recHead.load(memory_order_relaxed);
+  if (h - recTail.load(memory_order_acquire) == REC_SLOTS) {
+    if (!recWait) { recDropped++; return false; }
+    unique_lock<mutex> lk(recMutex);
+    recCv.wait(lk, [h]{ return h - recTail.load(memory_order_acquire) != REC_SLOTS; });
+  }
+  RecSlot &sl = recSlots[h % REC_SLOTS];
+  sl.ns = ns;
+  sl.bytes.assign(bytes);
+  recHead.store(h + 1, memory_order_release);
+  if (recWait) recNotify();
+  recFrames++;
+  return true;
+}
+
+// queues one written frame; ns is the time since recording started, full
+// says the frame redraws the whole screen (as the encoder reported it).
+// after a drop only a full redraw is taken: the player's own frame if it
+// was one, else the copy encodeScreen() made for the recording
+void recordFrame(const string &bytes, int64_t ns, bool full) {
+  if (!recFile || recFormat != REC_CAST || bytes.empty()) return;
+  if (recSkipping) {
+    if (!full) return;
+    recSkipping = false;
+  }
+  if (!recordQueue(bytes, ns)) recSkipping = true;
+}
+
+// keyframe base: blank glyphs, no attributes
+const uint8_t *recBlankPlane() {
+  static uint8_t blank[REC_PLANE];
+  if (blank[0] != ' ') memset(blank, ' ', HEIGHT * WIDTH);
+  return blank;
+}
+
+// fills plane with the arena in recording form: glyphs with the stars
+// blanked out, then explosion gradient steps
+void buildCellPlane(const vector<string> &scr, const AttrPlane &ovr, uint8_t *plane) {
+  uint8_t *attr = plane + HEIGHT * WIDTH;
+  for (int y=0;y<HEIGHT;y++) {
+    memcpy(plane + y*WIDTH, scr[y].data(), WIDTH);
+    uint8_t *a = attr + y*WIDTH;
+    memset(a, 0, WIDTH);
+    if (!ovr.row[y]) continue;
+    for (int x=0;x<WIDTH;x++)
+      for (int i=0; ovr.a[y][x] && i<EXPLOSION_FRAMES; i++)
+        if (ovr.a[y][x] == expGradientAttr[i]) { a[x] = i + 1; break; }
+  }
+  if (!starsEnabled) return;
+  for (int y=1;y<HEIGHT-1;y++) {
+    uint8_t *row = plane + y*WIDTH, *a = attr + y*WIDTH;
+    forEachStar(y, [row, a](int x, char star) {
+      if (row[x] == (uint8_t)star) row[x] = ' ';
+      else if (row[x] == ' ') a[x] |= REC_A_NOSTAR;
+    });
+  }
+}
+
+// REC_F_FLICKER and REC_F_STARS for the frame being drawn
+int cellPlaneFlags() {
+  return (animEffects && (tickCount/2)%2 != 0 ? REC_F_FLICKER : 0) | (starsEnabled ? REC_F_STARS : 0);
+}
+
+// queues the drawn arena as a cell-delta frame. A dropped frame leaves the
+// last queued plane as the base, so the next delta still decodes.
+void recordCells(const vector<string> &scr, const AttrPlane &ovr, const string &tail, long tick, uint64_t hash) {
+  if (!recFile || recFormat != REC_CELLS) return;
+  TraceScope ts("recordCells");
+  uint8_t *cur = recPlanes[recCur], *prev = recPlanes[recCur ^ 1];
+  buildCellPlane(scr, ovr, cur);
+
+  bool key = !recHavePrev || tick - recKeyTick >= REC_KEY_TICKS;
+  bool newTail = key || tail != recPrevTail;
+  recOut.clear();
+  recOut.push_back((char)((key ? REC_F_KEY : 0) | cellPlaneFlags() | (newTail ? REC_F_TAIL : 0) | REC_F_HASH));
+  appendVarint(recOut, key ? tick : tick - recLastTick);
+  appendVarint(recOut, zigzag(key ? starScroll : starScroll - recLastScroll));
+  appendLE(recOut, hash, 8);
+  recRuns.clear();
+  appendXorRuns(recRuns, cur, key ? recBlankPlane() : prev, REC_PLANE);
+  appendVarint(recOut, recRuns.size());
+  recOut += recRuns;
+  if (newTail) {
+    if (key) recTailBase.clear();
+    else recTailBase = recPrevTail;
+    recTailBase.resize(tail.size(), '\0');
+    recRuns.clear();
+    appendXorRuns(recRuns, (const uint8_t*)tail.data(), (const uint8_t*)recTailBase.data(), tail.size());
+    appendVarint(recOut, tail.size());
+    appendVarint(recOut, recRuns.size());
+    recOut += recRuns;
+  }
+  if (!recordQueue(recOut, 0)) return;
+  if (key) {
+    recKeys.push_back({(uint32_t)tick, recOffset});
+    recKeyTick = tick;
+  }
+  recOffset += recOut.size();
+  recCur ^= 1;
+  if (newTail) recPrevTail = tail;
+  recLastTick = tick;
+  recLastScroll = starScroll;
+  recHavePrev = true;
+}
+
+void recordClose() {
+  if (!recFile) return;
+  recStop.store(true, memory_order_release);
+  recNotify();
+  recThread.join();
+  if (recFormat == REC_CELLS) {
+    string idx;
+    for (auto &k: recKeys) {
+      appendLE(idx, k.tick, 4);
+      appendLE(idx, (uint32_t)k.offset, 4);
+      appendLE(idx, (uint32_t)(k.offset >> 32), 4);
+    }
+    appendLE(idx, (uint32_t)recKeys.size(), 4);
+    idx += "TKRX";
+    fwrite(idx.data(), 1, idx.size(), recFile);
+  }
+  fclose(recFile);
+  recFile = nullptr;
+  cerr << "recorded " << recFrames << " frames to " << recordPath;
+  if (recFormat == REC_CELLS) cerr << " (" << recOffset + recKeys.size() * 12 + 8 << " bytes)";
+  if (recDropped) cerr << " (" << recDropped << " dropped while the disk was busy)";
+  cerr << "\n";
+}
+
+// ---------- Shared-memory export ----------
+// --shm=NAME publishes every drawn frame into a POSIX shared-memory segment
+// as a cell plane (the .tkr layout) plus the HUD tail. A viewer process
+// (--view=NAME) maps it and renders it to its own terminal, so a headless
+// run can be watched live while the game pays only for filling the plane;
+// it never waits on, or even knows about, readers. A seqlock guards the
+// frame: seq is odd while the game writes, and a reader retries when seq
+// moved under its copy.
+const int SHM_TAIL_MAX = 8192;
+const uint32_t SHM_VERSION = 1;
+
+struct ShmFrame {
+  char magic[4];            // "TKSH"
+  uint32_t version, width, height;
+  atomic<uint32_t> seq;     // odd while a frame is being written
+  atomic<uint32_t> live;    // cleared when the game exits
+  uint32_t flags;           // REC_F_FLICKER / REC_F_STARS
+  int32_t scroll;
+  int64_t tick;
+  uint32_t tailLen;
+  char tail[SHM_TAIL_MAX];
+  uint8_t plane[REC_PLANE];
+};
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the seqlock needs lock-free atomics in shared memory");
+
+string shmName;
+ShmFrame *shmFrame = nullptr;
+
+// shm_open wants a single leading slash
+string shmPath(const string &name) { return name[0] == '/' ? name : "/" + name; }
+
+#if defined(_WIN32) || defined(_WIN64)
+bool shmOpen() {
+  cerr << "frame export needs POSIX shared memory; disabled\n";
+  return false;
+}
+void shmPublish(const vector<string> &, const AttrPlane &, const string &, long) {}
+void shmClose() {}
+#else
+bool shmOpen() {
+  string path = shmPath(shmName);
+  int fd = shm_open(path.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0) { cerr << "could not create shared memory " << path << "\n"; return false; }
+  void *p = ftruncate(fd, sizeof(ShmFrame)) == 0
+    ? mmap(nullptr, sizeof(ShmFrame), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (p == MAP_FAILED) { cerr << "could not map shared memory " << path << "\n"; shm_unlink(path.c_str()); return false; }
+  shmFrame = (ShmFrame*)p;
+  memcpy(shmFrame->magic, "TKSH", 4);
+  shmFrame->version = SHM_VERSION;
+  shmFrame->width = WIDTH;
+  shmFrame->height = HEIGHT;
+  shmFrame->seq.store(0, memory_order_relaxed);
+  shmFrame->live.store(1, memory_order_release);
+  return true;
+}
+
+void shmPublish(const vector<string> &scr, const AttrPlane &ovr, const string &tail, long tick) {
+  if (!shmFrame) return;
+  TraceScope ts("shmPublish");
+  ShmFrame &f = *shmFrame;
+  uint32_t seq = f.seq.load(memory_order_relaxed);
+  f.seq.store(seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  buildCellPlane(scr, ovr, f.plane);
+  f.flags = cellPlaneFlags();
+  f.scroll = starScroll;
+  f.tick = tick;
+  f.tailLen = min<size_t>(tail.size(), SHM_TAIL_MAX);
+  memcpy(f.tail, tail.data(), f.tailLen);
+  f.seq.store(seq + 2, memory_order_release);
+}
+
+void shmClose() {
+  if (!shmFrame) return;
+  shmFrame->live.store(0, memory_order_release);
+  munmap(shmFrame, sizeof(ShmFrame));
+  shmFrame = nullptr;
+  shm_unlink(shmPath(shmName).c_str());  // viewers keep their mapping
+}
+#endif
+
+// ---------- Rendering ----------
+// Frame buffers reused across ticks so steady-state rendering never allocates
+vector<string> screen = createEmptyScreen();
+string frameBuf;
+bool frameFull = false;     // frameBuf redraws the whole screen, not just changes
+string recKeyBuf;           // full redraw of the same frame, for a recording resyncing after a drop
+bool frameRecKey = false;   // recKeyBuf holds this frame
+uint64_t bytesWrittenTotal = 0;
+size_t lastFrameBytes = 0;  // bytes written for the last frame
+
+const int ENEMY_TYPE_COUNT = BOSS + 1;
+const char *ENEMY_TYPE_NAMES[ENEMY_TYPE_COUNT] = { "normal", "fast", "strong", "bouncer", "zigzag", "chaser", "boss" };
+
+void countEnemyTypes(int counts[ENEMY_TYPE_COUNT]) {
+  fill(counts, counts + ENEMY_TYPE_COUNT, 0);
+  for (auto &e: enemies) counts[e.type]++;
+}
+
+// appends the HUD and overlay lines shown below the arena
+void buildTail(string &out) {
+  // Count enemy types for HUD
+  int cnt[ENEMY_TYPE_COUNT];
+  countEnemyTypes(cnt);
+
+  // HUD line: power-ups / timers
+  char active[96];
+  int n = 0;
+  active[0] = '\0';
+  if (rapidFireTimer > 0)
+    n += snprintf(active + n, sizeof(active) - n, "RapidFire(%ds) ", rapidFireTimer/25);
+  if (damageBoostTimer > 0)
+    n += snprintf(active + n, sizeof(active) - n, "Damage++(%ds) ", damageBoostTimer/25);
+  if (playerCount == 1 && player.shieldCount > 0)
+    n += snprintf(active + n, sizeof(active) - n, "Shield:%d ", player.shieldCount);
+
+  // one tank: type, score and hp; two: each tank's own line item
+  char who[128];
+  if (playerCount == 1)
+    snprintf(who, sizeof(who), "Tank: %s | Score: %d | HP: %d", player.type.c_str(), score, player.hp);
+  else {
+    int w = 0;
+    for (int i=0;i<playerCount;i++) {
+      const Tank &t = players[i];
+      w += snprintf(who + w, sizeof(who) - w, "P%d %s %dpts HP:%d%s | ", i+1, t.type.c_str(), t.score,
+                    t.hp, !t.alive ? " DOWN" : t.shieldCount ? " +S" : "");
+    }
+    snprintf(who + w, sizeof(who) - w, "%s: %d", versus ? "Versus" : "Co-op", score);
+  }
+
+  char lag[48] = "";
+  if (inputLatency.recentCount)
+    snprintf(lag, sizeof(lag), " | Lag: %.0f/%.0fms", statsRecentPct(inputLatency, 50) / 1e6,
+             statsRecentPct(inputLatency, 99) / 1e6);
+
+  char hud[sizeof(who) + sizeof(active) + sizeof(lag) + 256];  // room for the fixed text and nine ints
+  snprintf(hud, sizeof(hud),
+           " %s | %s | Level: %d | Enemies: %d (N:%d F:%d S:%d B:%d Z:%d C:%d Boss:%d)%s"
+           "   (W/A/S/D move, Space shoot, P profiler, Q quit)",
+           who, n == 0 ? "No PowerUps" : active, level,
+           (int)enemies.size(), cnt[NORMAL], cnt[FAST], cnt[STRONG], cnt[BOUNCER], cnt[ZIGZAG], cnt[CHASER], cnt[BOSS], lag);
+  if (colorOutput) out += COL_TEXT;
+  out += hud;
+  if (colorOutput) out += COL_RESET;
+  out += '\n';
+  if (profOverlay) appendProfOverlay(out);
+}
+
+// encode screen, screenAttr and termFrame->tail against termShown into
+// frameBuf; termFrame holds the resulting screen until the frame is submitted
+void encodeScreen() {
+  frameBuf.clear();
+  if (frameBuf.capacity() == 0) frameBuf.reserve(WIDTH * HEIGHT * 10 + 2048);
+  if (needClear) { termShown->valid = false; needClear = false; }
+  frameFull = !termShown->valid;
+  termFrame->scroll = starScroll;
+  if (outputMode == OUT_ANSI) encodeFrame(screen, screenAttr, *termShown, *termFrame, frameBuf);
+  else encodePlainFrame(screen, *termShown, *termFrame, frameBuf);
+  frameRecKey = recSkipping && !frameFull;
+  if (frameRecKey) {
+    // the same screen from scratch, into a scratch model: the terminal keeps its diff
+    static TermModel recKeyModel;
+    static const TermModel noBase{};
+    recKeyModel.tail = termFrame->tail;
+    recKeyModel.scroll = starScroll;
+    recKeyBuf.clear();
+    if (outputMode == OUT_ANSI) encodeFrame(screen, screenAttr, noBase, recKeyModel, recKeyBuf);
+    else encodePlainFrame(screen, noBase, recKeyModel, recKeyBuf);
+  }
+}
+
+void spectateBroadcast();
+
+// draw the world at the current detail settings and star scroll
+void drawArena(vector<string> &scr, AttrPlane &attrs) {
+  clearScreen(scr);
+  clearAttrPlane(attrs);
+  drawBorder(scr);
+  drawStars(scr);
+  // draw items, bombs, laser first so they appear behind explosions/tank if overlap
+  drawItems(scr);
+  drawBombs(scr);
+  drawLaser(scr);
+  for (auto &e: enemies) drawEnemyShape(scr, e);
+  for (auto &b: bullets) drawBulletShape(scr, b);
+  drawExplosions(scr, attrs);
+  for (int i=0;i<playerCount;i++)
+    if (players[i].alive) drawTankShape(scr, players[i], &attrs);
+}
+
+// draw the world into screen and encode it
+void composeFrame() {
+  {
+    PhaseScope ps(PH_DRAW);
+    if (animEffects && starsEnabled) starScroll = tickCount / 2;
+    drawArena(screen, screenAttr);
+  }
+
+  PhaseScope ps(PH_ENCODE);
+  termFrame->tail.clear();
+  buildTail(termFrame->tail);
+  encodeScreen();
+  recordCells(screen, screenAttr, termFrame->tail, ticksTotal, worldHash);
+  shmPublish(screen, screenAttr, termFrame->tail, ticksTotal);
+  spectateBroadcast();
+}
+
+// ---------- Terminal output ----------
+// During play frames go out through a non-blocking fd (outFd). A frame is
+// written as far as the tty accepts; the rest waits for EPOLLOUT. Only the newest complete frame may
+// queue behind a partly written one: a partial frame is always finished
+// before anything else is sent, so escapes never get cut mid-sequence.
+struct OutFrame {
+  string bytes;
+  size_t off = 0;
+  int64_t submitNs = 0, budgetNs = 0;
+  int64_t keys[LAT_PENDING_MAX];  // input events this frame is the first to show
+  int nkeys = 0;
+  bool full = false;              // a full redraw: the recorder may resume on it
+  string recKey;                  // else a full redraw made for the recorder, if it needs one
+};
+OutFrame outCur, outNext;  // being written / newest waiting
+bool outHasCur = false, outHasNext = false;
+bool outNonBlocking = false;
+int outFd = 1;  // STDOUT_FILENO, or the tty reopened for play (see outputBegin)
+
+void loopWatchOutput(bool on);
+
+void frameWritten(OutFrame &f) {
+  latFrameWritten(f.keys, f.nkeys);
+  if (f.recKey.empty()) recordFrame(f.bytes, steadyNowNs() - recStartNs, f.full);
+  else recordFrame(f.recKey, steadyNowNs() - recStartNs, true);
+  lastFrameBytes = f.bytes.size();
+  bytesWrittenTotal += lastFrameBytes;
+  outputNoteWrite(lastFrameBytes, steadyNowNs() - f.submitNs, f.budgetNs);
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+void outputBegin() { termShown->valid = false; }
+void outputEnd() { if (outputMode == OUT_ANSI) cout << COL_RESET; }
+bool outputFlush() { return true; }
+void outputSubmit(const string &bytes, int64_t budgetNs) {
+  swap(termShown, termFrame);
+  outCur.bytes = bytes;
+  outCur.full = frameFull;
+  if (frameRecKey) outCur.recKey = recKeyBuf;
+  else outCur.recKey.clear();
+  outCur.submitNs = steadyNowNs();
+  outCur.budgetNs = budgetNs;
+  outCur.nkeys = 0;
+  latTakePending(outCur.keys, outCur.nkeys);
+  if (gConsole == nullptr) gConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+  COORD origin = {0,0};
+  SetConsoleCursorPosition(gConsole, origin);
+  DWORD written = 0;
+  WriteConsoleA(gConsole, bytes.c_str(), (DWORD)bytes.size(), &written, NULL);
+  frameWritten(outCur);
+}
+#else
+// writes until done or the tty pushes back; true when nothing is left queued
+bool outputFlush() {
+  while (outHasCur) {
+    OutFrame &f = outCur;
+    while (f.off < f.bytes.size()) {
+      ssize_t n = write(outFd, f.bytes.data() + f.off, f.bytes.size() - f.off);
+      if (n > 0) { f.off += n; continue; }
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        loopWatchOutput(true);
+        return false;
+      }
+      // output is gone: drop this frame and the one queued behind it (it was
+      // diffed against this one), and redraw in full once output works again
+      f.off = f.bytes.size();
+      if (outHasNext) { outHasNext = false; outFramesDropped++; }
+      termShown->valid = false;
+    }
+    frameWritten(f);
+    outHasCur = false;
+    if (outHasNext) {
+      swap(outCur, outNext);
+      swap(termShown, termQueued);
+      outCur.off = 0;
+      outHasCur = true;
+      outHasNext = false;
+    }
+  }
+  loopWatchOutput(false);
+  return true;
+}
+
+// bytes were encoded against termShown; termFrame is the screen they produce
+void outputSubmit(const string &bytes, int64_t budgetNs) {
+  OutFrame &f = outHasCur ? outNext : outCur;
+  swap(outHasCur ? termQueued : termShown, termFrame);
+  if (outHasCur && outHasNext) outFramesDropped++;  // keys of the dropped frame carry over
+  else f.nkeys = 0;
+  f.bytes = bytes;
+  f.full = frameFull;
+  if (frameRecKey) f.recKey = recKeyBuf;
+  else f.recKey.clear();
+  f.off = 0;
+  f.submitNs = steadyNowNs();
+  f.budgetNs = budgetNs;
+  latTakePending(f.keys, f.nkeys);
+  if (outHasCur) outHasNext = true;
+  else outHasCur = true;
+  outputFlush();
+}
+
+// O_NONBLOCK belongs to the open file description, which a terminal's
+// stdout shares with stdin, stderr and the parent shell. So a tty is
+// reopened to get a description of our own; any other stdout only goes
+// non-blocking when stdin and stderr are not the same file, else the
+// frames are written blocking.
+void outputBegin() {
+  cout << flush;
+  termShown->valid = false;  // menus drew over the arena
+  outFd = STDOUT_FILENO;
+  const char *tty = isatty(STDOUT_FILENO) ? ttyname(STDOUT_FILENO) : nullptr;
+  if (tty) {
+    int fd = open(tty, O_WRONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0) { outFd = fd; outNonBlocking = true; }
+    return;
+  }
+  struct stat out, other;
+  for (int fd: {STDIN_FILENO, STDERR_FILENO})
+    if (fstat(STDOUT_FILENO, &out) == 0 && fstat(fd, &other) == 0 && out.st_dev == other.st_dev && out.st_ino == other.st_ino)
+      return;
+  int flags = fcntl(STDOUT_FILENO, F_GETFL, 0);
+  outNonBlocking = fcntl(STDOUT_FILENO, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// finish whatever is queued, then hand stdout back to blocking iostreams
+void outputEnd() {
+  while (!outputFlush()) {
+    pollfd pfd = {outFd, POLLOUT, 0};
+    poll(&pfd, 1, 100);
+  }
+  if (outFd != STDOUT_FILENO) close(outFd);
+  else if (outNonBlocking) {
+    int flags = fcntl(STDOUT_FILENO, F_GETFL, 0);
+    fcntl(STDOUT_FILENO, F_SETFL, flags & ~O_NONBLOCK);
+  }
+  outFd = STDOUT_FILENO;
+  outNonBlocking = false;
+  if (outputMode == OUT_ANSI) cout << COL_RESET;  // frames leave the last cell's color set
+}
+#endif
+
+// budgetNs: time available per rendered frame, for the bandwidth estimator
+void renderScreen(int64_t budgetNs) {
+  TraceScope ts("renderScreen");
+  composeFrame();
+  PhaseScope ps(PH_WRITE);
+  outputSubmit(frameBuf, budgetNs);
+}
+
+// ---------- Local sockets ----------
+// Addresses name a Unix socket path or tcp:PORT on the loopback interface;
+// shared by spectators and lockstep play.
+#if !defined(_WIN32) && !defined(_WIN64)
+socklen_t localAddr(const string &addr, sockaddr_storage &ss) {
+  memset(&ss, 0, sizeof(ss));
+  if (addr.rfind("tcp:", 0) == 0) {
+    sockaddr_in *in = (sockaddr_in*)&ss;
+    in->sin_family = AF_INET;
+    in->sin_port = htons((uint16_t)atoi(addr.c_str() + 4));
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return sizeof(sockaddr_in);
+  }
+  sockaddr_un *un = (sockaddr_un*)&ss;
+  un->sun_family = AF_UNIX;
+  if (addr.size() >= sizeof(un->sun_path)) { errno = ENAMETOOLONG; return 0; }
+  strcpy(un->sun_path, addr.c_str());
+  return sizeof(sockaddr_un);
+}
+
+// bound and listening, replacing a stale Unix socket; -1 with errno set
+int listenLocal(const string &addr) {
+  sockaddr_storage ss;
+  socklen_t len = localAddr(addr, ss);
+  int fd = len ? socket(ss.ss_family, SOCK_STREAM, 0) : -1;
+  if (fd < 0) return -1;
+  int one = 1;
+  if (ss.ss_family == AF_INET) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  else unlink(addr.c_str());
+  if (bind(fd, (sockaddr*)&ss, len) < 0 || listen(fd, 8) < 0) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    return -1;
+  }
+  return fd;
+}
+
+// blocking connect; -1 with errno set
+int connectLocal(const string &addr) {
+  sockaddr_storage ss;
+  socklen_t len = localAddr(addr, ss);
+  int fd = len ? socket(ss.ss_family, SOCK_STREAM, 0) : -1;
+  if (fd < 0) return -1;
+  if (connect(fd, (sockaddr*)&ss, len) < 0) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    return -1;
+  }
+  return fd;
+}
+#endif
+
+// ---------- Spectators ----------
+// --spectate=PATH (Unix socket) or --spectate=tcp:PORT (localhost) streams
+// the game to any number of terminals, e.g. `nc -U PATH`. Spectators share
+// one diff chain of their own: each broadcast is encoded once against the
+// previous broadcast, and once more as a full redraw if any spectator needs
+// to (re)start, so cost does not grow with the audience. Encoded frames live
+// in a small pool of reference-counted buffers that every spectator queues
+// by index. One that falls SPEC_QUEUE frames behind loses its unsent frames
+// and restarts at a full redraw instead of being buffered for. Broadcasts
+// happen at most once per tick of wall time, so headless runs stream at
+// game speed; polled per tick like the metrics socket, no thread.
+const int SPEC_MAX_CLIENTS = 32;
+const int SPEC_QUEUE = 8;
+const int SPEC_BUFS = SPEC_MAX_CLIENTS + 2 * SPEC_QUEUE + 2;  // a stuck head per client plus the shared window
+const int64_t SPEC_STALL_NS = 10000000000LL;  // no progress for this long: hang up
+const int SPEC_SNDBUF = 32768;  // kernel buffering per spectator, or loopback would hide seconds of lag
+
+struct SpecBuf { string bytes; int refs = 0; };
+struct Spectator {
+  int fd = -1;
+  int queue[SPEC_QUEUE];  // SpecBuf indexes, oldest first
+  int head = 0, count = 0;
+  size_t off = 0;         // bytes of the oldest frame already sent
+  bool needKey = true;    // next frame must be a full redraw
+  int64_t progressNs = 0;
+};
+string spectatePath;
+long specBroadcasts = 0, specKeyframes = 0, specSends = 0, specSkips = 0, specServed = 0;
+int specCount = 0;
+
+#if defined(_WIN32) || defined(_WIN64)
+bool spectateOpen() {
+  cerr << "spectating needs POSIX sockets; disabled\n";
+  return false;
+}
+void spectatePoll() {}
+void spectateBroadcast() {}
+void spectateClose() {}
+#else
+int specFd = -1;
+bool specTcp = false;
+Spectator specClients[SPEC_MAX_CLIENTS];
+SpecBuf specBufs[SPEC_BUFS];
+TermModel specModels[3];
+TermModel *specPrev = &specModels[0], *specNext = &specModels[1];
+TermModel *specScratch = &specModels[2];  // result of a full redraw, same screen as specNext
+const TermModel specNoBase{};
+int64_t specNextNs = 0;
+// the arena and HUD redrawn for spectators while the local link runs below full detail
+vector<string> specScreen = createEmptyScreen();
+AttrPlane specAttr;
+string specTail;
+
+// Spectators have links of their own, so they always get full detail. While
+// this lives, drawing and encoding run at full detail (and the star scroll
+// that goes with it); the local settings come back when it ends.
+struct FullDetailScope {
+  bool active, anim, color;
+  int scroll;
+  explicit FullDetailScope(bool on) : active(on), anim(animEffects), color(colorOutput), scroll(starScroll) {
+    if (!active) return;
+    animEffects = colorOutput = true;
+    if (starsEnabled) starScroll = tickCount / 2;
+  }
+  ~FullDetailScope() {
+    if (!active) return;
+    animEffects = anim;
+    colorOutput = color;
+    starScroll = scroll;
+  }
+};
+
+bool spectateOpen() {
+  specTcp = spectatePath.rfind("tcp:", 0) == 0;
+  specFd = listenLocal(spectatePath);
+  if (specFd < 0) { cerr << "spectator socket " << spectatePath << ": " << strerror(errno) << "\n"; return false; }
+  fcntl(specFd, F_SETFL, fcntl(specFd, F_GETFL, 0) | O_NONBLOCK);
+  signal(SIGPIPE, SIG_IGN);  // a spectator hanging up must not kill the game
+  for (auto &b: specBufs) b.bytes.reserve(WIDTH * HEIGHT * 10 + 2048);
+  return true;
+}
+
+void specRelease(int buf) { specBufs[buf].refs--; }
+
+// drops every frame the spectator has not started sending
+void specDropUnsent(Spectator &c) {
+  int keep = c.off > 0 ? 1 : 0;
+  for (int i=keep; i<c.count; i++) specRelease(c.queue[(c.head + i) % SPEC_QUEUE]);
+  c.count = keep;
+  if (!keep) c.head = 0;
+}
+
+void specDisconnect(Spectator &c) {
+  c.off = 0;
+  specDropUnsent(c);
+  close(c.fd);
+  c.fd = -1;
+  specCount--;
+}
+
+// sends queued frames until the socket is full
+void specFlush(Spectator &c, int64_t now) {
+  while (c.count > 0) {
+    const string &b = specBufs[c.queue[c.head]].bytes;
+    ssize_t n = send(c.fd, b.data() + c.off, b.size() - c.off, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (n <= 0) { specDisconnect(c); return; }
+    c.off += n;
+    c.progressNs = now;
+    if (c.off < b.size()) continue;
+    specRelease(c.queue[c.head]);
+    c.head = (c.head + 1) % SPEC_QUEUE;
+    c.count--;
+    c.off = 0;
+    specSends++;
+  }
+  if (c.count > 0 && now - c.progressNs > SPEC_STALL_NS) specDisconnect(c);
+}
+
+void spectatePoll() {
+  if (specFd < 0) return;
+  int64_t now = steadyNowNs();
+  char junk[256];
+  for (auto &c: specClients) {
+    if (c.fd < 0) continue;
+    ssize_t n;
+    while ((n = read(c.fd, junk, sizeof(junk))) > 0) {}  // spectators have no say
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) { specDisconnect(c); continue; }
+    specFlush(c, now);
+  }
+  int fd;
+  while ((fd = accept(specFd, nullptr, nullptr)) >= 0) {
+    Spectator *c = nullptr;
+    for (auto &s: specClients) if (s.fd < 0) { c = &s; break; }
+    if (!c) { close(fd); continue; }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int sndbuf = SPEC_SNDBUF;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    if (specTcp) { int one = 1; setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); }
+    c->fd = fd;
+    c->head = c->count = 0;
+    c->off = 0;
+    c->needKey = true;
+    c->progressNs = now;
+    specCount++;
+    specServed++;
+  }
+}
+
+// a pool buffer no spectator holds, or -1
+int specAcquire() {
+  for (int i=0;i<SPEC_BUFS;i++) if (specBufs[i].refs == 0) return i;
+  return -1;
+}
+
+void specEnqueue(Spectator &c, int buf) {
+  specBufs[buf].refs++;
+  c.queue[(c.head + c.count) % SPEC_QUEUE] = buf;
+  c.count++;
+}
+
+// encodes the frame just composed for spectators and queues it for each
+void spectateBroadcast() {
+  if (specFd < 0) return;
+  if (specCount == 0) { specPrev->valid = false; return; }
+  int64_t now = steadyNowNs();
+  if (now < specNextNs) return;
+  specNextNs = max(specNextNs + FRAME_NS, now);
+  TraceScope ts("spectateBroadcast");
+
+  // the player's frame as drawn, unless the local link has stepped detail down
+  bool redraw = !animEffects || !colorOutput;
+  FullDetailScope full(redraw);
+  if (redraw) {
+    drawArena(specScreen, specAttr);
+    specTail.clear();
+    buildTail(specTail);
+  }
+  const vector<string> &scr = redraw ? specScreen : screen;
+  const AttrPlane &attrs = redraw ? specAttr : screenAttr;
+  const string &tail = redraw ? specTail : termFrame->tail;
+
+  // the diff, or a full redraw when the chain has no base yet
+  int diff = specAcquire();
+  if (diff < 0) return;  // every buffer is held by a stuck spectator
+  specBufs[diff].refs++;  // held while queuing
+  specNext->tail = tail;
+  specNext->scroll = starScroll;
+  string &db = specBufs[diff].bytes;
+  db.clear();
+  bool diffIsKey = !specPrev->valid;
+  if (diffIsKey) db += "\x1B[?25l";
+  encodeFrame(scr, attrs, *specPrev, *specNext, db);
+  int key = diffIsKey ? diff : -1;
+  for (auto &c: specClients) {
+    if (c.fd < 0) continue;
+    if (!c.needKey && c.count == SPEC_QUEUE) {
+      specDropUnsent(c);
+      c.needKey = true;
+      specSkips++;
+    }
+    if (c.needKey && key < 0) {
+      key = specAcquire();
+      if (key < 0) continue;
+      specBufs[key].refs++;
+      specScratch->tail = tail;
+      specScratch->scroll = starScroll;
+      string &kb = specBufs[key].bytes;
+      kb.assign("\x1B[?25l");
+      encodeFrame(scr, attrs, specNoBase, *specScratch, kb);
+      specKeyframes++;
+    }
+    if (c.count == SPEC_QUEUE) continue;  // a partial frame plus a full queue; retry next broadcast
+    specEnqueue(c, c.needKey ? key : diff);
+    c.needKey = false;
+    specFlush(c, now);
+  }
+  specRelease(diff);
+  if (key >= 0 && key != diff) specRelease(key);
+  if (diffIsKey) specKeyframes++;
+  swap(specPrev, specNext);
+  specBroadcasts++;
+}
+
+void spectateClose() {
+  if (specFd < 0) return;
+  for (auto &c: specClients) {
+    if (c.fd < 0) continue;
+    ssize_t w = send(c.fd, "\x1B[0m\x1B[?25h\r\n", 12, 0);  // best effort
+    (void)w;
+    specDisconnect(c);
+  }
+  close(specFd);
+  specFd = -1;
+  if (!specTcp) unlink(spectatePath.c_str());
+  if (specServed)
+    cerr << specServed << " spectators, " << specBroadcasts << " broadcasts (" << specKeyframes << " full redraws), "
+         << specSends << " frames sent, " << specSkips << " skips to catch up\n";
+}
+#endif
+
+// ---------- Lockstep ----------
+// Two processes play one game (--host=ADDR, --join=ADDR; same address forms
+// as --spectate). Only inputs cross the socket: each tick a player sends the
+// keys it pressed, to take effect LOCK_DELAY ticks later on both sides, and
+// both run the same simulation from the host's seed. Messages also carry a
+// hash of the sender's world as of LOCK_DELAY ticks before the keys apply,
+// so a desync is caught within a few ticks. A tick only runs once the
+// other player's keys for it are in; the delay hides the round trip.
+//   handshake, host -> joiner: "TKL" 2, u64 seed, u8 flags (1 versus, 2 swarm), u8 delay, u8 tank
+//   handshake, joiner -> host: "TKL" 2, u8 tank
+//   per tick: u32 tick, u8 n, n key bytes, u64 hash
+const int LOCK_VERSION = 2;
+const int LOCK_RING = 64;          // ticks of inputs and hashes kept; more than any delay
+const int LOCK_MAX_DELAY = 16;
+const int LOCK_KEYS = 4;           // keys per tick; more wait for the next tick
+const int64_t LOCK_STALL_NS = 10000000000LL;  // no input from the peer for this long: give up
+
+struct LockInput { long tick = -1; int n = 0; char keys[LOCK_KEYS]; };
+struct LockHash { long tick = -1; uint64_t hash = 0; };
+
+string lockAddr;
+bool lockHost = false;
+bool lockstep = false;       // a peer is connected
+int lockDelay = 3;           // --input-delay=N, host's choice
+int lockLocal = 0;           // our index in players
+int lockTanks[2] = {1, 1};
+long lockTick = 0;           // next tick to simulate
+long lockDesyncTick = -1;
+bool lockPeerGone = false, lockTimedOut = false;
+long lockStalls = 0;         // ticks that had to wait for the peer's input
+
+#if defined(_WIN32) || defined(_WIN64)
+bool lockstepOpen() {
+  cerr << "lockstep play needs POSIX sockets; disabled\n";
+  return false;
+}
+bool lockstepStart(int) { return false; }
+void lockstepQueueKey(int) {}
+bool lockstepTick() { return false; }
+bool lockstepReady() { return true; }
+void lockstepWait() {}
+void lockstepClose() {}
+#else
+int lockFd = -1;
+LockInput lockInputs[2][LOCK_RING];
+LockHash lockOurHashes[LOCK_RING], lockPeerHashes[LOCK_RING];
+char lockPending[LOCK_KEYS * 4];  // local keys not yet sent
+int lockPendingCount = 0;
+long lockSentTick = -1;           // our inputs are sent up to here
+string lockRecvBuf;
+int64_t lockWaitSinceNs = 0;
+long lockStallTick = -1;
+
+bool lockSendAll(const void *data, size_t len) {
+  const char *p = (const char*)data;
+  while (len > 0) {
+    ssize_t n = send(lockFd, p, len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pollfd pfd = { lockFd, POLLOUT, 0 };
+      poll(&pfd, 1, 100);
+      continue;
+    }
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool lockRecvAll(void *data, size_t len) {
+  char *p = (char*)data;
+  while (len > 0) {
+    ssize_t n = recv(lockFd, p, len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+void putLE(uint8_t *p, uint64_t v, int bytes) {
+  for (int i=0;i<bytes;i++) p[i] = (uint8_t)(v >> (8*i));
+}
+
+uint64_t getLE(const uint8_t *p, int bytes) {
+  uint64_t v = 0;
+  for (int i=0;i<bytes;i++) v |= (uint64_t)p[i] << (8*i);
+  return v;
+}
+
+// host: waits for the other player; joiner: connects, retrying while the
+// host is still starting
+bool lockstepOpen() {
+  if (lockHost) {
+    int ls = listenLocal(lockAddr);
+    if (ls < 0) { cerr << "lockstep socket " << lockAddr << ": " << strerror(errno) << "\n"; return false; }
+    cerr << "waiting for player 2 on " << lockAddr << " (start it with --join=" << lockAddr << ")\n";
+    lockFd = accept(ls, nullptr, nullptr);
+    close(ls);
+    if (lockAddr.rfind("tcp:", 0) != 0) unlink(lockAddr.c_str());
+  } else {
+    for (int tries=0; tries<100 && lockFd < 0; tries++) {
+      lockFd = connectLocal(lockAddr);
+      if (lockFd < 0 && errno != ENOENT && errno != ECONNREFUSED) break;
+      if (lockFd < 0) this_thread::sleep_for(chrono::milliseconds(100));
+    }
+  }
+  if (lockFd < 0) { cerr << "could not reach the other player at " << lockAddr << ": " << strerror(errno) << "\n"; return false; }
+  int one = 1;
+  if (lockAddr.rfind("tcp:", 0) == 0) setsockopt(lockFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  signal(SIGPIPE, SIG_IGN);
+  lockLocal = lockHost ? 0 : 1;
+  lockstep = true;
+  return true;
+}
+
+// exchanges settings and tank choices, then starts both sides at tick 0
+bool lockstepStart(int tank) {
+  uint8_t msg[15];
+  memcpy(msg, "TKL", 3);
+  msg[3] = LOCK_VERSION;
+  bool ok;
+  if (lockHost) {
+    uint64_t seed = (uint64_t)time(nullptr) * 0x9E3779B97F4A7C15ULL ^ (uint64_t)steadyNowNs();
+    putLE(msg + 4, seed, 8);
+    msg[12] = (versus ? 1 : 0) | (swarm ? 2 : 0);
+    msg[13] = (uint8_t)lockDelay;
+    msg[14] = (uint8_t)tank;
+    uint8_t reply[5];
+    ok = lockSendAll(msg, 15) && lockRecvAll(reply, 5) && memcmp(reply, "TKL", 3) == 0 && reply[3] == LOCK_VERSION;
+    if (ok) { seedRng(seed); lockTanks[0] = tank; lockTanks[1] = reply[4]; }
+  } else {
+    ok = lockRecvAll(msg, 15) && memcmp(msg, "TKL", 3) == 0 && msg[3] == LOCK_VERSION && msg[13] <= LOCK_MAX_DELAY;
+    if (ok) {
+      seedRng(getLE(msg + 4, 8));
+      versus = (msg[12] & 1) != 0;
+      swarm = (msg[12] & 2) != 0;
+      lockDelay = msg[13];
+      lockTanks[0] = msg[14];
+      lockTanks[1] = tank;
+      uint8_t reply[5] = { 'T', 'K', 'L', (uint8_t)LOCK_VERSION, (uint8_t)tank };
+      ok = lockSendAll(reply, 5);
+    }
+  }
+  if (!ok) { cerr << "lockstep handshake with " << lockAddr << " failed\n"; return false; }
+  for (int i=0;i<2;i++) lockTanks[i] = max(1, min(6, lockTanks[i]));
+  fcntl(lockFd, F_SETFL, fcntl(lockFd, F_GETFL, 0) | O_NONBLOCK);
+  playerCount = 2;
+  // the first lockDelay ticks have no input on either side
+  for (int p=0;p<2;p++)
+    for (int t=0;t<LOCK_RING;t++) lockInputs[p][t] = LockInput();
+  for (int t=0;t<lockDelay;t++)
+    for (int p=0;p<2;p++) { lockInputs[p][t].tick = t; lockInputs[p][t].n = 0; }
+  for (int t=0;t<LOCK_RING;t++) lockOurHashes[t] = lockPeerHashes[t] = LockHash();
+  lockTick = 0;
+  lockSentTick = lockDelay - 1;
+  lockWaitSinceNs = steadyNowNs();
+  lockRecvBuf.reserve(4096);
+  return true;
+}
+
+void lockstepQueueKey(int c) {
+  if (lockPendingCount < (int)sizeof(lockPending)) lockPending[lockPendingCount++] = (char)c;
+}
+
+void lockNoteHash(LockHash *mine, LockHash *theirs, long tick, uint64_t hash) {
+  LockHash &h = mine[tick % LOCK_RING];
+  h.tick = tick;
+  h.hash = hash;
+  const LockHash &o = theirs[tick % LOCK_RING];
+  if (o.tick == tick && o.hash != hash && lockDesyncTick < 0) {
+    lockDesyncTick = tick;
+    running = false;
+  }
+}
+
+// reads whatever the peer sent and files its inputs and hashes
+void lockRecv() {
+  char buf[1024];
+  ssize_t n;
+  while ((n = recv(lockFd, buf, sizeof(buf), 0)) > 0) lockRecvBuf.append(buf, n);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) lockPeerGone = true;
+  size_t at = 0;
+  int peer = 1 - lockLocal;
+  while (lockRecvBuf.size() - at >= 5) {
+    const uint8_t *m = (const uint8_t*)lockRecvBuf.data() + at;
+    int keys = m[4];
+    if (keys > LOCK_KEYS) { lockPeerGone = true; break; }  // not a peer we understand
+    if (lockRecvBuf.size() - at < (size_t)(13 + keys)) break;
+    long tick = (long)getLE(m, 4);
+    LockInput &in = lockInputs[peer][tick % LOCK_RING];
+    in.tick = tick;
+    in.n = keys;
+    memcpy(in.keys, m + 5, keys);
+    lockNoteHash(lockPeerHashes, lockOurHashes, tick - lockDelay, getLE(m + 5 + keys, 8));
+    at += 13 + keys;
+  }
+  lockRecvBuf.erase(0, at);
+}
+
+// runs tick lockTick once both players' inputs for it are known; false
+// while still waiting for the peer
+bool lockstepTick() {
+  if (lockSentTick < lockTick + lockDelay) {
+    // our keys for lockTick+delay, with the state they will be applied to
+    // lockDelay ticks from now hashed as of this tick
+    long t = lockTick + lockDelay;
+    uint64_t hash = worldHash;
+    LockInput &in = lockInputs[lockLocal][t % LOCK_RING];
+    in.tick = t;
+    in.n = min(lockPendingCount, LOCK_KEYS);
+    memcpy(in.keys, lockPending, in.n);
+    lockPendingCount -= in.n;
+    memmove(lockPending, lockPending + in.n, lockPendingCount);
+    uint8_t msg[13 + LOCK_KEYS];
+    putLE(msg, (uint64_t)t, 4);
+    msg[4] = (uint8_t)in.n;
+    memcpy(msg + 5, in.keys, in.n);
+    putLE(msg + 5 + in.n, hash, 8);
+    if (!lockSendAll(msg, 13 + in.n)) lockPeerGone = true;
+    lockNoteHash(lockOurHashes, lockPeerHashes, lockTick, hash);
+    lockSentTick = t;
+  }
+  lockRecv();
+  const LockInput &theirs = lockInputs[1 - lockLocal][lockTick % LOCK_RING];
+  if (theirs.tick != lockTick) {
+    if (lockStallTick != lockTick) { lockStallTick = lockTick; lockStalls++; }
+    if (lockPeerGone) running = false;
+    else if (steadyNowNs() - lockWaitSinceNs > LOCK_STALL_NS) { lockTimedOut = true; running = false; }
+    return false;
+  }
+  if (!running) return false;  // desync found while receiving
+  for (int p=0;p<2;p++) players[p].cooldown = max(0, players[p].cooldown - 1);
+  for (int p=0;p<2;p++) {
+    const LockInput &in = lockInputs[p][lockTick % LOCK_RING];
+    for (int k=0;k<in.n;k++) handleTankKey(p, in.keys[k]);
+  }
+  updateGameLogic();
+  lockTick++;
+  lockWaitSinceNs = steadyNowNs();
+  return true;
+}
+
+// true once lockstepTick() has something to do: the peer's input for
+// lockTick is in, or the session is over. reads the socket itself since
+// only the epoll loopWait watches lockFd
+bool lockstepReady() {
+  if (lockFd >= 0 && !lockPeerGone) lockRecv();
+  return lockInputs[1 - lockLocal][lockTick % LOCK_RING].tick == lockTick || lockPeerGone || !running
+    || steadyNowNs() - lockWaitSinceNs > LOCK_STALL_NS;
+}
+
+// sleeps until the peer sends something, at most a tick
+void lockstepWait() {
+  pollfd pfd = { lockFd, POLLIN, 0 };
+  poll(&pfd, 1, FRAME_MS);
+}
+
+void lockstepClose() {
+  if (lockFd < 0) return;
+  close(lockFd);
+  lockFd = -1;
+}
+#endif
+
+// how a lockstep game ended, one line per fact
+void lockstepReport(ostream &os) {
+  if (lockDesyncTick >= 0) os << "DESYNC: the two games disagreed at tick " << lockDesyncTick << "\n";
+  else if (lockTimedOut) os << "The other player stopped responding.\n";
+  else if (lockPeerGone) os << "The other player left.\n";
+  if (versus) {
+    int alive = players[0].alive + players[1].alive;
+    if (alive == 1) os << "Player " << (players[0].alive ? 1 : 2) << " wins!\n";
+    else os << "No winner.\n";
+  }
+  for (int i=0;i<2;i++)
+    os << "Player " << i+1 << (i == lockLocal ? " (you)" : "") << ": " << players[i].type << ", " << players[i].score << " points\n";
+}
+
+// ---------- Metrics ----------
+// Optional Prometheus text endpoint on a Unix socket (--metrics=PATH), e.g.
+//   curl --unix-socket PATH http://localhost/metrics
+// Polled once per tick: no thread, and an idle socket costs one accept().
+string metricsPath;
+double tickRate = 0;
+long rateTicks = 0;
+int64_t rateStartNs = 0;
+
+#if defined(_WIN32) || defined(_WIN64)
+bool metricsOpen() {
+  cerr << "metrics endpoint needs Unix domain sockets; disabled\n";
+  return false;
+}
+void metricsPoll() {}
+void metricsClose() {}
+#else
+int metricsFd = -1;
+const int METRICS_MAX_CLIENTS = 8;
+int metricsClients[METRICS_MAX_CLIENTS];   // answered, draining until the peer closes
+int64_t metricsClientSince[METRICS_MAX_CLIENTS];
+string metricsBuf;
+
+bool metricsOpen() {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (metricsPath.size() >= sizeof(addr.sun_path)) { cerr << "metrics socket path too long\n"; return false; }
+  strcpy(addr.sun_path, metricsPath.c_str());
+  metricsFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (metricsFd < 0) return false;
+  unlink(metricsPath.c_str());
+  if (bind(metricsFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(metricsFd, 8) < 0) {
+    cerr << "metrics socket " << metricsPath << ": " << strerror(errno) << "\n";
+    close(metricsFd);
+    metricsFd = -1;
+    return false;
+  }
+  fcntl(metricsFd, F_SETFL, fcntl(metricsFd, F_GETFL, 0) | O_NONBLOCK);
+  fill(metricsClients, metricsClients + METRICS_MAX_CLIENTS, -1);
+  return true;
+}
+
+void appendMetric(const char *name, const char *labels, double v) {
+  char buf[160];
+  snprintf(buf, sizeof(buf), "%s%s %.9g\n", name, labels, v);
+  metricsBuf += buf;
+}
+
+// during --batch the games live on the pool threads, so the world gauges come
+// from each run's published progress instead; false when no batch is running
+bool appendBatchMetrics();
+
+void buildMetrics() {
+  char labels[96];
+  metricsBuf.clear();
+  metricsBuf += "# TYPE tank_ticks_total counter\n";
+  appendMetric("tank_ticks_total", "", (double)ticksTotal);
+  metricsBuf += "# TYPE tank_tick_rate gauge\n";
+  appendMetric("tank_tick_rate", "", tickRate);
+  metricsBuf += "# TYPE tank_phase_seconds summary\n";
+  for (int ph=0; ph<PH_COUNT; ph++) {
+    for (int q: {50, 99}) {
+      snprintf(labels, sizeof(labels), "{phase=\"%s\",quantile=\"%s\"}", PHASE_NAMES[ph], q == 50 ? "0.5" : "0.99");
+      appendMetric("tank_phase_seconds", labels, profRecentPct((ProfPhase)ph, q) / 1e9);
+    }
+    snprintf(labels, sizeof(labels), "{phase=\"%s\"}", PHASE_NAMES[ph]);
+    appendMetric("tank_phase_seconds_sum", labels, profStats[ph].total / 1e9);
+    appendMetric("tank_phase_seconds_count", labels, (double)profStats[ph].count);
+  }
+  metricsBuf += "# TYPE tank_input_latency_seconds summary\n";
+  appendMetric("tank_input_latency_seconds", "{quantile=\"0.5\"}", statsRecentPct(inputLatency, 50) / 1e9);
+  appendMetric("tank_input_latency_seconds", "{quantile=\"0.99\"}", statsRecentPct(inputLatency, 99) / 1e9);
+  appendMetric("tank_input_latency_seconds_sum", "", inputLatency.total / 1e9);
+  appendMetric("tank_input_latency_seconds_count", "", (double)inputLatency.count);
+  if (!appendBatchMetrics()) {
+    int cnt[ENEMY_TYPE_COUNT];
+    countEnemyTypes(cnt);
+    metricsBuf += "# TYPE tank_enemies gauge\n";
+    for (int t=0; t<ENEMY_TYPE_COUNT; t++) {
+      snprintf(labels, sizeof(labels), "{type=\"%s\"}", ENEMY_TYPE_NAMES[t]);
+      appendMetric("tank_enemies", labels, cnt[t]);
+    }
+    metricsBuf += "# TYPE tank_entities gauge\n";
+    appendMetric("tank_entities", "{kind=\"bullet\"}", (double)bullets.size());
+    appendMetric("tank_entities", "{kind=\"bomb\"}", (double)bombs.size());
+    appendMetric("tank_entities", "{kind=\"item\"}", (double)items.size());
+    appendMetric("tank_entities", "{kind=\"explosion\"}", (double)explosions.size());
+    metricsBuf += "# TYPE tank_score gauge\n";
+    appendMetric("tank_score", "", score);
+    metricsBuf += "# TYPE tank_level gauge\n";
+    appendMetric("tank_level", "", level);
+  }
+  metricsBuf += "# TYPE tank_frame_bytes gauge\n";
+  appendMetric("tank_frame_bytes", "{stage=\"encoded\"}", (double)frameBuf.size());
+  appendMetric("tank_frame_bytes", "{stage=\"written\"}", (double)lastFrameBytes);
+  metricsBuf += "# TYPE tank_written_bytes_total counter\n";
+  appendMetric("tank_written_bytes_total", "", (double)bytesWrittenTotal);
+  metricsBuf += "# TYPE tank_output_bytes_per_second gauge\n";
+  appendMetric("tank_output_bytes_per_second", "", netBytesPerSec);
+  metricsBuf += "# TYPE tank_write_seconds gauge\n";
+  appendMetric("tank_write_seconds", "", netWriteNsEwma / 1e9);
+  metricsBuf += "# TYPE tank_link_bytes_per_second gauge\n";
+  appendMetric("tank_link_bytes_per_second", "", netLinkEstimate);
+  metricsBuf += "# TYPE tank_output_dropped_frames_total counter\n";
+  appendMetric("tank_output_dropped_frames_total", "", (double)outFramesDropped);
+  metricsBuf += "# TYPE tank_detail_level gauge\n";
+  appendMetric("tank_detail_level", "", detailLevel);
+  metricsBuf += "# TYPE tank_allocations_total counter\n";
+  appendMetric("tank_allocations_total", "", (double)gAllocCount.load());
+  metricsBuf += "# TYPE tank_allocated_bytes_total counter\n";
+  appendMetric("tank_allocated_bytes_total", "", (double)gAllocBytes.load());
+  metricsBuf += "# TYPE tank_frees_total counter\n";
+  appendMetric("tank_frees_total", "", (double)gFreeCount.load());
+  metricsBuf += "# TYPE tank_renders_total counter\n";
+  appendMetric("tank_renders_total", "", (double)loopRenders);
+  metricsBuf += "# TYPE tank_catchup_ticks_total counter\n";
+  appendMetric("tank_catchup_ticks_total", "", (double)loopCatchUpTicks);
+  metricsBuf += "# TYPE tank_skipped_frames_total counter\n";
+  appendMetric("tank_skipped_frames_total", "", (double)loopSkippedFrames);
+  metricsBuf += "# TYPE tank_dropped_ticks_total counter\n";
+  appendMetric("tank_dropped_ticks_total", "", (double)loopDroppedTicks);
+  metricsBuf += "# TYPE tank_spectators gauge\n";
+  appendMetric("tank_spectators", "", specCount);
+  metricsBuf += "# TYPE tank_spectator_broadcasts_total counter\n";
+  appendMetric("tank_spectator_broadcasts_total", "", (double)specBroadcasts);
+  metricsBuf += "# TYPE tank_spectator_skips_total counter\n";
+  appendMetric("tank_spectator_skips_total", "", (double)specSkips);
+  metricsBuf += "# TYPE tank_frame_allocations gauge\n";
+  appendMetric("tank_frame_allocations", "", (double)profLastAllocs[PH_FRAME]);
+  if (poolWorkers > 0) {
+    metricsBuf += "# TYPE tank_pool_utilization gauge\n";
+    for (int i=0;i<=poolWorkers;i++) {
+      snprintf(labels, sizeof(labels), "{thread=\"%s\"}", i == 0 ? "main" : POOL_THREAD_NAMES[i-1]);
+      appendMetric("tank_pool_utilization", labels, poolUtilization(i));
+    }
+    metricsBuf += "# TYPE tank_pool_tasks_total counter\n";
+    for (int i=0;i<=poolWorkers;i++) {
+      snprintf(labels, sizeof(labels), "{thread=\"%s\"}", i == 0 ? "main" : POOL_THREAD_NAMES[i-1]);
+      appendMetric("tank_pool_tasks_total", labels, (double)poolStats[i].tasks.load());
+    }
+  }
+}
+
+void metricsPoll() {
+  if (metricsFd < 0) return;
+  int64_t now = profNowNs();
+  if (now - rateStartNs >= 1000000000LL) {
+    tickRate = (ticksTotal - rateTicks) * 1e9 / (now - rateStartNs);
+    rateTicks = ticksTotal;
+    rateStartNs = now;
+  }
+  // finish clients we already answered once they hang up (or after 1s)
+  char junk[512];
+  for (int i=0;i<METRICS_MAX_CLIENTS;i++) {
+    int fd = metricsClients[i];
+    if (fd < 0) continue;
+    ssize_t n;
+    while ((n = read(fd, junk, sizeof(junk))) > 0) {}
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || now - metricsClientSince[i] > 1000000000LL) {
+      close(fd);
+      metricsClients[i] = -1;
+    }
+  }
+  int fd;
+  while ((fd = accept(metricsFd, nullptr, nullptr)) >= 0) {
+    int slot = -1;
+    for (int i=0;i<METRICS_MAX_CLIENTS;i++) if (metricsClients[i] < 0) { slot = i; break; }
+    if (slot < 0) { close(fd); continue; }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    buildMetrics();
+    char head[128];
+    int hn = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: %zu\r\n\r\n", metricsBuf.size());
+    // a snapshot is a few KB and fits the socket buffer
+    if (write(fd, head, hn) == hn) {
+      ssize_t w = write(fd, metricsBuf.data(), metricsBuf.size());
+      (void)w;
+    }
+    shutdown(fd, SHUT_WR);
+    metricsClients[slot] = fd;
+    metricsClientSince[slot] = now;
+  }
+}
+
+void metricsClose() {
+  if (metricsFd < 0) return;
+  for (int &fd: metricsClients) if (fd >= 0) { close(fd); fd = -1; }
+  close(metricsFd);
+  metricsFd = -1;
+  unlink(metricsPath.c_str());
+}
+#endif
+
+// ---------- Event loop ----------
+// On Linux the process sleeps in epoll_wait on a timerfd armed with absolute
+// tick deadlines, the input thread's eventfd (it owns stdin) and control fds
+// such as the metrics socket. Elsewhere it falls back to short sleeps.
+enum LoopEvent { EV_TIMER = 1, EV_INPUT = 2, EV_CONTROL = 4, EV_OUTPUT = 8 };
+
+#if defined(__linux__)
+int loopEpollFd = -1, loopTimerFd = -1;
+bool loopOutputWatched = false;
+
+void loopAdd(int fd) {
+  epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  epoll_ctl(loopEpollFd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// EPOLLOUT on outFd while a frame is only partly written
+void loopWatchOutput(bool on) {
+  if (on == loopOutputWatched || loopEpollFd < 0) return;
+  epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLOUT;
+  ev.data.fd = outFd;
+  if (epoll_ctl(loopEpollFd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, outFd, &ev) == 0 || !on)
+    loopOutputWatched = on;
+}
+
+void loopInit() {
+  loopEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  loopTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  loopAdd(loopTimerFd);
+  if (inputNotifyFd >= 0) loopAdd(inputNotifyFd);
+  if (metricsFd >= 0) loopAdd(metricsFd);
+  if (specFd >= 0) loopAdd(specFd);
+  if (lockFd >= 0) loopAdd(lockFd);
+}
+
+// waits until deadlineNs (steady clock; <0 = no deadline) or any fd event
+int loopWait(int64_t deadlineNs) {
+  if (loopEpollFd < 0) loopInit();
+  itimerspec its;
+  memset(&its, 0, sizeof(its));
+  if (deadlineNs >= 0) {
+    its.it_value.tv_sec = deadlineNs / 1000000000LL;
+    its.it_value.tv_nsec = deadlineNs % 1000000000LL;
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) its.it_value.tv_nsec = 1;
+  }
+  timerfd_settime(loopTimerFd, TFD_TIMER_ABSTIME, &its, nullptr);
+  epoll_event evs[8];
+  int n = epoll_wait(loopEpollFd, evs, 8, -1);
+  int mask = 0;
+  for (int i=0;i<n;i++) {
+    uint64_t v;
+    int fd = evs[i].data.fd;
+    if (fd == loopTimerFd) { mask |= EV_TIMER; ssize_t r = read(fd, &v, sizeof(v)); (void)r; }
+    else if (fd == inputNotifyFd) { mask |= EV_INPUT; ssize_t r = read(fd, &v, sizeof(v)); (void)r; }
+    else if (fd == outFd) { mask |= EV_OUTPUT; outputFlush(); }
+    else if (fd == lockFd) {
+      // file the peer's inputs now, or a readable socket would wake every wait
+      mask |= EV_CONTROL;
+      lockRecv();
+      if (lockPeerGone) epoll_ctl(loopEpollFd, EPOLL_CTL_DEL, lockFd, nullptr);
+    }
+    else { mask |= EV_CONTROL; metricsPoll(); spectatePoll(); }
+  }
+  return mask;
+}
+
+void loopClose() {
+  if (loopEpollFd >= 0) { close(loopEpollFd); close(loopTimerFd); }
+  loopEpollFd = loopTimerFd = -1;
+}
+#else
+void loopWatchOutput(bool) {}
+void loopInit() {}
+int loopWait(int64_t deadlineNs) {
+  outputFlush();
+  int64_t wait = (outHasCur ? 2 : 50) * 1000000LL;
+  if (deadlineNs >= 0) wait = min(wait, deadlineNs - steadyNowNs());
+  if (wait > 0) this_thread::sleep_for(chrono::nanoseconds(wait));
+  return (deadlineNs >= 0 && steadyNowNs() >= deadlineNs ? EV_TIMER : 0) | (kb_hit() ? EV_INPUT : 0);
+}
+void loopClose() {}
+#endif
+
+// blocks until a key arrives and returns it
+int waitKey() {
+  cout << flush;  // prompts have no newline
+  while (!kb_hit()) loopWait(-1);
+  return kb_get();
+}
+
+// ---------- Menu ----------
+int chooseTank() {
+  cout << "\x1B[2J\x1B[H" << COL_TEXT;
+  cout << "===== CHOOSE YOUR TANK =====\n\n";
+  cout << "1. Standard    - HP:5  Speed:1  FireRate:6  (Balanced)\n";
+  cout << "2. Heavy       - HP:8  Speed:1  FireRate:8  (Armored)\n";
+  cout << "3. Light       - HP:3  Speed:2  FireRate:4  (Agile)\n";
+  cout << "4. Sniper      - HP:4  Speed:1  FireRate:9  (High damage, narrow)\n";
+  cout << "5. RapidFire   - HP:4  Speed:1  FireRate:2  (Very fast shooting)\n";
+  cout << "6. Plasma      - HP:6  Speed:1  FireRate:5  (Energy shots)\n\n";
+  cout << "Choose 1..6: " << colorReset();
+  int choice = waitKey();
+  if (choice >= '1' && choice <= '6') return choice - '0';
+  return 1;
+}
+
+void showTitleScreen() {
+  cout << "\x1B[2J\x1B[H" << COL_TEXT;
+  cout << "=====================================\n";
+  cout << "        TANK SHOOTER - v5.0          \n";
+  cout << "    (PowerUps & Boss Skills added)   \n";
+  cout << "=====================================\n\n";
+  cout << "1. Start Game\n2. Instructions\n3. Tank & Enemy Info\n4. Quit\n\n";
+  cout << colorReset() << "Choose an option: ";
+}
+
+void showInstructions() {
+  cout << "\x1B[2J\x1B[H" << COL_TEXT;
+  cout << "Instructions:\n";
+  cout << "- Move with W/A/S/D.\n";
+  cout << "- Shoot with Space.\n";
+  cout << "- Avoid or destroy enemies before they hit you.\n";
+  cout << "- PowerUps drop from enemies sometimes (+ S R D)\n";
+  cout << "- Boss uses Laser (horizontal) and Bomb Rain.\n";
+  cout << "- Press P in game to toggle the frame profiler overlay.\n\n";
+  cout << "Press any key to return.\n" << colorReset();
+  waitKey();
+}
+
+void showInfoScreen() {
+    cout << "\x1B[2J\x1B[H" << COL_TEXT;
+    cout << "==============================\n";
+    cout << "     TANK & ENEMY INFO       \n";
+    cout << "==============================\n\n";
+
+    cout << fgColor(93) << "TANK TYPES:\n" << colorReset();
+    cout << COL_TANK << "Standard " << colorReset() << "- '*' shape, balanced stats.\n";
+    cout << fgColor(91) << "Heavy     " << colorReset() << "- '#' tank, strong armor, slow speed.\n";
+    cout << fgColor(96) << "Light     " << colorReset() << "- '+' agile but fragile.\n";
+    cout << fgColor(95) << "Sniper    " << colorReset() << "- '^' narrow gun, high damage.\n";
+    cout << fgColor(93) << "RapidFire " << colorReset() << "- '=' barrel, fires very fast.\n";
+    cout << fgColor(35) << "Plasma    " << colorReset() << "- 'O' style, energy bullets.\n\n";
+
+    cout << fgColor(93) << "ENEMY TYPES:\n" << colorReset();
+    cout << fgColor(91) << "# Normal   " << colorReset() << "- Basic slow-moving target.\n";
+    cout << fgColor(95) << "/^\\ Fast   " << colorReset() << "- Moves quickly, low HP.\n";
+    cout << fgColor(34) << "+-+ Strong " << colorReset() << "- Tough armor, slower.\n";
+    cout << fgColor(93) << "& Bouncer  " << colorReset() << "- Moves side-to-side as it descends.\n";
+    cout << fgColor(96) << "Z Zigzag   " << colorReset() << "- Erratic movement pattern.\n";
+    cout << fgColor(95) << "C Chaser   " << colorReset() << "- Tracks and hunts player.\n";
+    cout << fgColor(35) << "BOSS       " << colorReset() << "- Large tank with Laser and Bomb skills.\n\n";
+
+    cout << fgColor(97) << "PowerUps (drop): + Health, S Shield, R RapidFire, D DamageBoost\n\n" << colorReset();
+    cout << "Press any key to return to menu..." << endl;
+    waitKey();
+}
+
+// ---------- Game loop ----------
+// reset the world for a new game with the given tank (1..6)
+Tank tankFor(int choice, int x) {
+  if (choice == 1) return Tank(x, HEIGHT-4, 5, "Standard", 1, 6, 1, 1, 0);
+  else if (choice == 2) return Tank(x, HEIGHT-4, 8, "Heavy", 1, 8, 1, 1, 0);
+  else if (choice == 3) return Tank(x, HEIGHT-4, 3, "Light", 2, 4, 1, 1, 0);
+  else if (choice == 4) return Tank(x, HEIGHT-4, 4, "Sniper", 1, 9, 2, 1, 0);
+  else if (choice == 5) return Tank(x, HEIGHT-4, 4, "RapidFire", 1, 2, 1, 1, 0);
+  else return Tank(x, HEIGHT-4, 6, "Plasma", 1, 5, 1, 1, 0);
+}
+
+// choice2 picks the second tank when playerCount is 2
+void resetGame(int choice, int choice2 = 1) {
+  bullets.clear(); enemies.clear(); explosions.clear(); items.clear(); bombs.clear();
+  // capacity survives clear(), so entity growth stops once these are warm
+  bullets.reserve(512); enemies.reserve(swarm ? 4096 : 512); explosions.reserve(512); items.reserve(128); bombs.reserve(256);
+  laser = LaserBeam();
+  score = 0; tickCount = 0; level = 1; enemySpawnRate = START_ENEMY_RATE;
+  running = true;
+  rapidFireTimer = 0; damageBoostTimer = 0;
+  gameLatency = PhaseStats();
+
+  if (playerCount == 1) player = tankFor(choice, WIDTH/2);
+  else {
+    players[0] = tankFor(choice, WIDTH/3);
+    players[1] = tankFor(choice2, 2*WIDTH/3);
+  }
+  spawnEnemiesByLevel();
+  worldHash = hashWorld();
+}
+
+// one simulation step at the nominal rate; input is drained per tick.
+// In lockstep the keys are queued for the peer instead, and the step waits
+// (returns false) until the peer's keys for it are in.
+bool simTick() {
+  if (lockstep) {
+    {
+      PhaseScope pi(PH_INPUT);
+      KeyEvent ev;
+      while (kb_poll(ev)) {
+        latNoteKey(ev.ts);
+        if (ev.key == 'p' || ev.key == 'P') { profOverlay = !profOverlay; needClear = true; }
+        else lockstepQueueKey(ev.key);
+      }
+    }
+    if (!lockstepTick()) return false;
+    ticksTotal++;
+    return true;
+  }
+  { PhaseScope pi(PH_INPUT); processInputGameplay(); }
+  updateGameLogic();
+  ticksTotal++;
+  return true;
+}
+
+// Fixed timestep: the sim always advances every FRAME_NS on absolute
+// deadlines, catching up with back-to-back ticks after a slow frame.
+// Rendering happens once new state exists, at most every renderIntervalNs.
+const int MAX_CATCHUP_TICKS = 5;
+int renderFpsCap = 0;  // --fps=N; 0 renders every simulated tick
+
+void runGameLoop() {
+  int choice = chooseTank();
+  if (lockstep) {
+    cout << "\x1B[2J\x1B[H" << COL_TEXT << "Waiting for the other player...\n" << colorReset() << flush;
+    if (!lockstepStart(choice)) { running = false; return; }
+    resetGame(lockTanks[0], lockTanks[1]);
+  } else {
+    resetGame(choice);
+  }
+  if (outputMode == OUT_ANSI) cout << "\x1B[?25l"; // hide cursor
+  outputBegin();
+
+  int64_t renderIntervalNs = renderFpsCap > 0 ? max<int64_t>(FRAME_NS, 1000000000LL / renderFpsCap) : FRAME_NS;
+  int64_t nextTick = steadyNowNs(), nextRender = nextTick;
+  bool dirty = false;  // simulated state not yet on screen
+  bool stalled = false;  // lockstep: waiting for the peer's input
+  while (running) {
+    int64_t now = steadyNowNs();
+    if (stalled && !lockstepReady() && !(dirty && now >= nextRender)) {
+      // still no input from the peer: nothing to simulate or draw, so no frame
+      loopWait(now + FRAME_NS);  // woken early by the peer's input
+      metricsPoll();
+      spectatePoll();
+      continue;
+    }
+    if (now < nextTick && !(dirty && now >= nextRender)) {
+      loopWait(dirty ? min(nextTick, nextRender) : nextTick);
+      continue;
+    }
+    profBeginFrame();
+    bool worked = false;  // a tick ran or a frame was drawn
+    {
+      PhaseScope ps(PH_FRAME);
+      int ticks = 0;
+      while (running && now >= nextTick && ticks < MAX_CATCHUP_TICKS) {
+        if (!simTick()) { stalled = true; break; }
+        stalled = false;
+        nextTick += FRAME_NS;
+        ticks++;
+      }
+      if (ticks > 1) loopCatchUpTicks += ticks - 1;
+      if (running && now >= nextTick && !stalled) {
+        // too far behind to catch up: let the game slow down instead
+        int64_t behind = (now - nextTick) / FRAME_NS + 1;
+        loopDroppedTicks += behind;
+        nextTick += behind * FRAME_NS;
+      }
+      if (ticks > 0) dirty = worked = true;
+      if (dirty && (now >= nextRender || !running)) {
+        int64_t interval = renderIntervalNs * renderRateDivisor;
+        renderScreen(interval);
+        dirty = false;
+        worked = true;
+        loopRenders++;
+        int64_t late = now > nextRender ? (now - nextRender) / interval : 0;
+        loopSkippedFrames += late;
+        nextRender += (late + 1) * interval;
+      }
+      if (!worked) ps.discard();  // the lockstep peer held us up: no frame to account
+    }
+    if (worked) profEndFrame();
+    metricsPoll();
+    spectatePoll();
+  }
+  outputEnd();
+
+  if (outputMode == OUT_ANSI) cout << "\x1B[?25h"; // show cursor
+  cout << "\x1B[2J\x1B[H" << COL_TEXT;
+  cout << "\n?? GAME OVER ??\n\n";
+  cout << "Final Score: " << score << "\n";
+  cout << "Level Reached: " << level << "\n";
+  if (lockstep) lockstepReport(cout);
+  if (gameLatency.count) {
+    char lat[96];
+    snprintf(lat, sizeof(lat), "Input latency: p50 %.1f ms, p99 %.1f ms\n",
+             statsHistPct(gameLatency, 50) / 1e6, statsHistPct(gameLatency, 99) / 1e6);
+    cout << lat;
+  }
+  if (lockstep) {
+    // one game per connection
+    lockstepClose();
+    cout << "Press any key to quit.\n";
+    waitKey();
+    return;
+  }
+  cout << "Press 'r' to restart or any key to return.\n";
+  int c = waitKey();
+  if (c == 'r' || c == 'R') runGameLoop();
+}
+
+// ---------- Headless ----------
+// Bot-driven runs without a terminal: the world is simulated, drawn and
+// encoded every tick but nothing is written. Games restart when the bot dies.
+const int ALLOC_WARMUP_TICKS = 500;
+
+// steer under the lowest enemy and keep firing; returns the key count
+int botKeys(const Tank &t, char keys[2]) {
+  const Enemy *target = nullptr;
+  int n = 0;
+  for (auto &e: enemies) if (!target || e.y > target->y) target = &e;
+  if (target && target->x < t.x) keys[n++] = 'a';
+  else if (target && target->x > t.x) keys[n++] = 'd';
+  keys[n++] = ' ';
+  return n;
+}
+
+void botInput() {
+  player.cooldown = max(0, player.cooldown - 1);
+  char keys[2];
+  int n = botKeys(player, keys);
+  for (int i=0;i<n;i++) handleGameplayKey(keys[i]);
+}
+
+// lockstep: the bot plays our tank; false once the session is over
+bool botLockstepTick() {
+  char keys[2];
+  int n = botKeys(players[lockLocal], keys);
+  for (int i=0;i<n;i++) lockstepQueueKey(keys[i]);
+  while (running) {
+    if (lockstepTick()) return true;
+    lockstepWait();
+  }
+  return false;
+}
+
+bool emitFrames = false;  // --emit-frames: headless frames go to stdout
+
+// runs ticks headless; with allocCheck, fails on any allocation after warm-up
+int runHeadless(long ticks, bool allocCheck) {
+  if (lockstep) {
+    if (!lockstepStart(1)) return 1;
+    resetGame(lockTanks[0], lockTanks[1]);
+  } else {
+    resetGame(1);
+  }
+  int games = 1;
+  long badTicks = 0;
+  bool sessionOver = false;  // lockstep peer left or disagreed
+  auto start = chrono::steady_clock::now();
+  for (long t=0; t<ticks; t++) {
+    if (sessionOver) { ticks = t; break; }
+    profBeginFrame();
+    {
+      PhaseScope ps(PH_FRAME);
+      if (lockstep) {
+        sessionOver = !botLockstepTick();
+      } else {
+        { PhaseScope pi(PH_INPUT); botInput(); }
+        updateGameLogic();
+      }
+      composeFrame();
+      swap(termShown, termFrame);  // as if written, so the next frame is a diff
+      if (emitFrames) {
+        PhaseScope pw(PH_WRITE);
+        fwrite(frameBuf.data(), 1, frameBuf.size(), stdout);
+        bytesWrittenTotal += frameBuf.size();
+      }
+      recordFrame(frameBuf, t * FRAME_NS, frameFull);  // simulated time, so playback runs at game speed
+    }
+    profEndFrame();
+    ticksTotal++;
+    metricsPoll();
+    spectatePoll();
+    if (allocCheck && t >= ALLOC_WARMUP_TICKS && profLastAllocs[PH_FRAME] > 0) {
+      if (badTicks++ < 10) {
+        cerr << "tick " << t << ": " << profLastAllocs[PH_FRAME] << " allocations ("
+             << profLastAllocBytes[PH_FRAME] << " bytes) in";
+        for (int ph=0; ph<PH_FRAME; ph++)
+          if (profLastAllocs[ph]) cerr << " " << PHASE_NAMES[ph] << "=" << profLastAllocs[ph];
+        cerr << "\n";
+      }
+    }
+    if (!running && !sessionOver) { resetGame(1 + games % 6, 1 + (games + 1) % 6); games++; }
+  }
+  double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  char hash[40];
+  snprintf(hash, sizeof(hash), ", world hash %016llx", (unsigned long long)worldHash);
+  cerr << ticks << " ticks, " << games << " games, " << (long)(ticks / max(secs, 1e-9)) << " ticks/s, "
+       << (double)profStats[PH_FRAME].allocs / max(ticks, 1L) << " allocs/tick" << hash;
+  if (emitFrames) {
+    fflush(stdout);
+    cerr << ", " << bytesWrittenTotal << " bytes of " << OUTPUT_MODE_NAMES[outputMode] << " frames";
+  }
+  cerr << "\n";
+  if (lockstep) {
+    char line[160];
+    snprintf(line, sizeof(line), "lockstep as player %d: %ld ticks, input delay %d, %ld ticks waited for the peer\n",
+             lockLocal + 1, lockTick, lockDelay, lockStalls);
+    cerr << line;
+    if (sessionOver) lockstepReport(cerr);
+    if (lockDesyncTick >= 0) return 1;
+  }
+  if (!allocCheck) return 0;
+  if (badTicks) {
+    cerr << "alloc-check FAILED: " << badTicks << " of " << max(0L, ticks - ALLOC_WARMUP_TICKS)
+         << " ticks after warm-up allocated\n";
+    return 1;
+  }
+  cerr << "alloc-check passed: no allocations after " << ALLOC_WARMUP_TICKS << " warm-up ticks\n";
+  return 0;
+}
+
+// --batch=N with --headless=T plays N independent bot games of T ticks
+// (seeds S..S+N-1, S from --seed) side by side on the worker pool. Jobs are
+// simulated only, each in the world of the thread running it, so a seed
+// gives the same result at any thread count. A task graph chains the
+// reports, which print in seed order as soon as each game is done.
+// While they run, each job publishes its game's progress for the metrics
+// endpoint, which the main thread keeps serving between and during jobs.
+struct BatchJob {
+  uint64_t seed;
+  long ticks;
+  bool swarm;
+  int games, bestScore, bestLevel;
+  uint64_t hash;
+  int64_t ns;
+  atomic<long> liveTicks{0};
+  atomic<int> liveGames{0}, liveScore{0}, liveLevel{0}, liveEnemies{0};
+};
+
+BatchJob *batchJobs = nullptr;  // while a batch runs
+int batchJobCount = 0;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+bool appendBatchMetrics() {
+  if (!batchJobs) return false;
+  // one labelled sample per run
+  auto family = [](const char *name, const char *type, auto value) {
+    char labels[48];
+    metricsBuf += string("# TYPE ") + name + " " + type + "\n";
+    for (int i=0;i<batchJobCount;i++) {
+      snprintf(labels, sizeof(labels), "{seed=\"%llu\"}", (unsigned long long)batchJobs[i].seed);
+      appendMetric(name, labels, (double)value(batchJobs[i]));
+    }
+  };
+  family("tank_batch_ticks_total", "counter", [](const BatchJob &j) { return j.liveTicks.load(memory_order_relaxed); });
+  family("tank_batch_games_total", "counter", [](const BatchJob &j) { return j.liveGames.load(memory_order_relaxed); });
+  family("tank_score", "gauge", [](const BatchJob &j) { return j.liveScore.load(memory_order_relaxed); });
+  family("tank_level", "gauge", [](const BatchJob &j) { return j.liveLevel.load(memory_order_relaxed); });
+  family("tank_enemies", "gauge", [](const BatchJob &j) { return j.liveEnemies.load(memory_order_relaxed); });
+  return true;
+}
+#endif
+
+// the main thread keeps the metrics endpoint answering while it waits
+void batchIdle() {
+  metricsPoll();
+  this_thread::sleep_for(chrono::milliseconds(1));
+}
+
+void batchPlay(void *ctx, int i, int) {
+  BatchJob &j = ((BatchJob*)ctx)[i];
+  int64_t t0 = profNowNs();
+  seedRng(j.seed);
+  playerCount = 1;
+  versus = false;
+  swarm = j.swarm;
+  resetGame(1);
+  j.games = 1;
+  j.bestScore = j.bestLevel = 0;
+  bool mainThread = !tlsPoolThread;
+  for (long t=0; t<j.ticks; t++) {
+    botInput();
+    updateGameLogic();
+    if (!running) {
+      j.bestScore = max(j.bestScore, score);
+      j.bestLevel = max(j.bestLevel, level);
+      resetGame(1 + j.games % 6);
+      j.games++;
+    }
+    ticksTotal.fetch_add(1, memory_order_relaxed);
+    j.liveTicks.store(t + 1, memory_order_relaxed);
+    j.liveGames.store(j.games, memory_order_relaxed);
+    j.liveScore.store(score, memory_order_relaxed);
+    j.liveLevel.store(level, memory_order_relaxed);
+    j.liveEnemies.store((int)enemies.size(), memory_order_relaxed);
+    if (mainThread) metricsPoll();
+  }
+  j.bestScore = max(j.bestScore, score);
+  j.bestLevel = max(j.bestLevel, level);
+  j.hash = worldHash;
+  j.ns = profNowNs() - t0;
+}
+
+void batchReport(void *ctx, int i, int) {
+  const BatchJob &j = ((BatchJob*)ctx)[i];
+  char line[160];
+  snprintf(line, sizeof(line), "seed %-10llu %4d games, best score %6d, best level %3d, world hash %016llx, %.0f ms\n",
+           (unsigned long long)j.seed, j.games, j.bestScore, j.bestLevel, (unsigned long long)j.hash, j.ns / 1e6);
+  cerr << line;
+}
+
+int runBatch(int runs, long ticks, uint64_t seed) {
+  vector<BatchJob> jobs(runs);
+  TaskGraph graph(2 * runs);
+  for (int i=0;i<runs;i++) {
+    jobs[i].seed = seed + i;
+    jobs[i].ticks = ticks;
+    jobs[i].swarm = swarm;
+    int play = graph.add(batchPlay, jobs.data(), i);
+    int report = graph.add(batchReport, jobs.data(), i);
+    graph.precede(play, report);
+    if (i > 0) graph.precede(report - 2, report);
+  }
+  batchJobs = jobs.data();
+  batchJobCount = runs;
+  int64_t t0 = profNowNs();
+  graph.run(batchIdle);
+  double secs = (profNowNs() - t0) / 1e9;
+  batchJobs = nullptr;
+  cerr << runs << " games of " << ticks << " ticks on " << poolWorkers + 1 << (poolWorkers ? " threads" : " thread") << " in " << secs << " s, "
+       << (long)(runs * ticks / max(secs, 1e-9)) << " ticks/s\n";
+  return 0;
+}
+
+// encodes the captured arenas once, either each as a full redraw or each as
+// a diff against the one before; returns ns taken and sums bytes and a hash
+int64_t encodeArenas(const vector<vector<string>> &arenas, const vector<AttrPlane> &planes, const vector<int> &scrolls,
+                     const vector<int> &ticks, bool diff, string &out, size_t &bytes, uint64_t &hash) {
+  bytes = 0;
+  hash = 1469598103934665603ULL;
+  termShown->valid = false;
+  termShown->tail.clear();
+  termFrame->tail.clear();
+  int64_t t0 = profNowNs();
+  for (size_t f=0; f<arenas.size(); f++) {
+    if (!diff) termShown->valid = false;
+    out.clear();
+    termFrame->scroll = starScroll = scrolls[f];
+    tickCount = ticks[f];
+    encodeFrame(arenas[f], planes[f], *termShown, *termFrame, out);
+    swap(termShown, termFrame);
+    bytes += out.size();
+    for (unsigned char c: out) hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return profNowNs() - t0;
+}
+
+// plays frames with the bot, then times each supported run encoder over the
+// captured arenas in ASCII and half-block mode, as full redraws and as
+// diffs; outputs must match
+int benchEncode(int frames) {
+  resetGame(1);
+  vector<vector<string>> arenas;
+  vector<AttrPlane> planes;
+  vector<int> scrolls, ticks;
+  arenas.reserve(frames);
+  for (int t=0; t<frames; t++) {
+    botInput();
+    updateGameLogic();
+    composeFrame();
+    arenas.push_back(screen);
+    planes.push_back(screenAttr);
+    scrolls.push_back(starScroll);
+    ticks.push_back(tickCount);
+    if (!running) resetGame(1);
+  }
+  const RunEncoder *saved = runEncoder;
+  string out;
+  out.reserve(WIDTH*HEIGHT*10);
+  bool savedHalf = halfBlocks;
+  uint64_t refHash[4] = {0, 0, 0, 0};
+  int rc = 0;
+  for (int i=0; i<RUN_ENCODER_COUNT; i++) {
+    if (!runEncoderSupported(RUN_ENCODERS[i])) { cerr << RUN_ENCODERS[i].name << ": not supported\n"; continue; }
+    runEncoder = &RUN_ENCODERS[i];
+    for (int mode=0; mode<4; mode++) {
+      bool diff = mode & 1;
+      halfBlocks = mode & 2;
+      size_t bytes = 0;
+      uint64_t hash = 0;
+      int64_t best = INT64_MAX;
+      for (int rep=0; rep<5; rep++) best = min(best, encodeArenas(arenas, planes, scrolls, ticks, diff, out, bytes, hash));
+      if (i == 0) refHash[mode] = hash;
+      else if (hash != refHash[mode]) { cerr << runEncoder->name << ": output differs from scalar\n"; rc = 1; }
+      fprintf(stderr, "%-7s %-5s %-4s %8.0f ns/frame %8.0f bytes/frame\n", runEncoder->name,
+              halfBlocks ? "half" : "ascii", diff ? "diff" : "full", (double)best / max(frames, 1), (double)bytes / max(frames, 1));
+    }
+  }
+  runEncoder = saved;
+  halfBlocks = savedHalf;
+  return rc;
+}
+
+// ---------- Replay ----------
+// --play=FILE maps a .tkr recording read-only and feeds its frames through the
+// normal frame encoder, so it replays at any color depth, in half blocks or
+// as plain text. Seeking starts at the last keyframe before the target (from
+// the index) and decodes forward, at most REC_KEY_TICKS frames.
+struct RecFrame {
+  int flags;
+  long tick;
+  int scroll;
+  uint64_t hash;                  // 0 without REC_F_HASH
+  const uint8_t *runs, *runsEnd;
+  const uint8_t *tailRuns, *tailRunsEnd;  // null without REC_F_TAIL
+  size_t tailLen;
+  const uint8_t *next;
+};
+
+struct Replay {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  const uint8_t *end = nullptr;   // frames stop here (index or end of file)
+  const uint8_t *pos = nullptr;   // next frame
+  vector<RecKey> keys;
+  uint8_t plane[REC_PLANE];
+  string tail;
+  long tick = 0, lastTick = 0;
+  int scroll = 0, flags = 0;
+  bool paused = false;
+};
+Replay replay;
+
+#if defined(_WIN32) || defined(_WIN64)
+bool replayMapFile(const string &path) {
+  HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (f == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER sz;
+  HANDLE m = GetFileSizeEx(f, &sz) && sz.QuadPart > 0 ? CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+  CloseHandle(f);
+  if (!m) return false;
+  void *p = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(m);  // the view keeps the mapping alive
+  if (!p) return false;
+  replay.data = (const uint8_t*)p;
+  replay.size = (size_t)sz.QuadPart;
+  return true;
+}
+void replayUnmap() { if (replay.data) UnmapViewOfFile(replay.data); replay.data = nullptr; }
+#else
+bool replayMapFile(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void *p = fstat(fd, &st) == 0 && st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (p == MAP_FAILED) return false;
+  replay.data = (const uint8_t*)p;
+  replay.size = st.st_size;
+  return true;
+}
+void replayUnmap() { if (replay.data) munmap((void*)replay.data, replay.size); replay.data = nullptr; }
+#endif
+
+uint32_t readLE(const uint8_t *p, int bytes) {
+  uint32_t v = 0;
+  for (int i=0;i<bytes;i++) v |= (uint32_t)p[i] << (8*i);
+  return v;
+}
+
+// parses the frame at p, which follows a frame at prevTick/prevScroll
+bool parseRecFrame(const uint8_t *p, const uint8_t *end, long prevTick, int prevScroll, RecFrame &f) {
+  uint64_t tick, scroll, n;
+  if (p >= end) return false;
+  f.flags = *p++;
+  if (!readVarint(p, end, tick) || !readVarint(p, end, scroll)) return false;
+  f.hash = 0;
+  if (f.flags & REC_F_HASH) {
+    if (end - p < 8) return false;
+    f.hash = readLE(p, 4) | (uint64_t)readLE(p + 4, 4) << 32;
+    p += 8;
+  }
+  if (!readVarint(p, end, n) || n > (uint64_t)(end - p)) return false;
+  bool key = f.flags & REC_F_KEY;
+  f.tick = key ? (long)tick : prevTick + (long)tick;
+  f.scroll = (int)(key ? unzigzag(scroll) : prevScroll + unzigzag(scroll));
+  f.runs = p;
+  f.runsEnd = p += n;
+  f.tailRuns = f.tailRunsEnd = nullptr;
+  f.tailLen = 0;
+  if (f.flags & REC_F_TAIL) {
+    if (!readVarint(p, end, tick) || tick > 0xFFFF || !readVarint(p, end, n) || n > (uint64_t)(end - p)) return false;
+    f.tailLen = tick;
+    f.tailRuns = p;
+    f.tailRunsEnd = p += n;
+  }
+  f.next = p;
+  return true;
+}
+
+// XORs the runs in [p, end) into dst[0, len)
+bool applyXorRuns(uint8_t *dst, size_t len, const uint8_t *p, const uint8_t *end) {
+  size_t at = 0;
+  while (p < end) {
+    uint64_t skip, n;
+    if (!readVarint(p, end, skip) || !readVarint(p, end, n) || n > (uint64_t)(end - p) || skip + n > len - at)
+      return false;
+    at += skip;
+    for (uint64_t i=0; i<n; i++) dst[at++] ^= *p++;
+  }
+  return true;
+}
+
+bool replayApply(const RecFrame &f) {
+  if (f.flags & REC_F_KEY) {
+    memcpy(replay.plane, recBlankPlane(), REC_PLANE);
+    replay.tail.clear();
+  }
+  if (!applyXorRuns(replay.plane, REC_PLANE, f.runs, f.runsEnd)) return false;
+  if (f.tailRuns) {
+    replay.tail.resize(f.tailLen, '\0');
+    if (!applyXorRuns((uint8_t*)&replay.tail[0], f.tailLen, f.tailRuns, f.tailRunsEnd)) return false;
+  }
+  replay.tick = f.tick;
+  replay.scroll = f.scroll;
+  replay.flags = f.flags;
+  replay.pos = f.next;
+  return true;
+}
+
+bool replayPeek(RecFrame &f) { return parseRecFrame(replay.pos, replay.end, replay.tick, replay.scroll, f); }
+
+// walks frame headers from p; collects keyframes when the file has no
+// index and returns the tick of the last complete frame
+long replayScan(const uint8_t *p, bool collectKeys) {
+  RecFrame f;
+  long tick = 0;
+  int scroll = 0;
+  while (parseRecFrame(p, replay.end, tick, scroll, f)) {
+    if (collectKeys && (f.flags & REC_F_KEY)) replay.keys.push_back({(uint32_t)f.tick, (uint64_t)(p - replay.data)});
+    tick = f.tick;
+    scroll = f.scroll;
+    p = f.next;
+  }
+  if (collectKeys) replay.end = p;  // drop a torn last frame
+  return tick;
+}
+
+bool replayOpen(const string &path) {
+  if (!replayMapFile(path)) { cerr << "could not open " << path << "\n"; return false; }
+  const uint8_t *d = replay.data;
+  if (replay.size < (size_t)REC_HEADER_BYTES || memcmp(d, "TKR", 3) != 0 || d[3] < 1 || d[3] > REC_VERSION) {
+    cerr << path << " is not a .tkr recording\n";
+    return false;
+  }
+  if (d[4] != WIDTH || d[5] != HEIGHT) {
+    cerr << path << " was recorded at " << (int)d[4] << "x" << (int)d[5] << ", not " << WIDTH << "x" << HEIGHT << "\n";
+    return false;
+  }
+  replay.end = d + replay.size;
+  if (replay.size >= (size_t)REC_HEADER_BYTES + 8 && memcmp(replay.end - 4, "TKRX", 4) == 0) {
+    uint64_t count = readLE(replay.end - 8, 4);
+    if (count * 12 + 8 <= replay.size - REC_HEADER_BYTES) {
+      const uint8_t *idx = replay.end - 8 - count * 12;
+      for (uint64_t i=0; i<count; i++, idx += 12)
+        replay.keys.push_back({readLE(idx, 4), readLE(idx + 4, 4) | (uint64_t)readLE(idx + 8, 4) << 32});
+      replay.end -= 8 + count * 12;
+    }
+  }
+  if (replay.keys.empty()) replay.lastTick = replayScan(d + REC_HEADER_BYTES, true);
+  if (replay.keys.empty() || replay.keys.back().offset >= (uint64_t)(replay.end - d)) {
+    cerr << path << " holds no complete frames\n";
+    return false;
+  }
+  replay.lastTick = replayScan(d + replay.keys.back().offset, false);
+  return true;
+}
+
+// shows the last frame at or before tick
+void replaySeek(long tick) {
+  auto it = upper_bound(replay.keys.begin(), replay.keys.end(), tick,
+                        [](long t, const RecKey &k) { return t < (long)k.tick; });
+  if (it != replay.keys.begin()) --it;
+  replay.pos = replay.data + it->offset;
+  RecFrame f;
+  bool first = true;
+  while (replayPeek(f) && (first || f.tick <= tick)) {
+    if (!replayApply(f)) break;
+    first = false;
+  }
+}
+
+// rebuilds screen, screenAttr and the tail from the current plane and
+// encodes them; status, if given, is shown as an extra HUD line
+void replayRender(const char *status) {
+  const uint8_t *glyph = replay.plane, *attr = replay.plane + HEIGHT * WIDTH;
+  bool stars = (replay.flags & REC_F_STARS) && starsEnabled;  // --no-stars and plain output leave them out
+  starScroll = replay.scroll;
+  starsInFrame = stars;
+  // encodeFrame picks the flicker phase and the half-row star step from it
+  tickCount = (replay.flags & REC_F_FLICKER ? 2 : 0) | (int)(replay.tick & 1);
+  clearAttrPlane(screenAttr);
+  for (int y=0;y<HEIGHT;y++) {
+    char *row = &screen[y][0];
+    const uint8_t *a = attr + y*WIDTH;
+    memcpy(row, glyph + y*WIDTH, WIDTH);
+    if (stars && y > 0 && y < HEIGHT-1)
+      forEachStar(y, [row, a](int x, char star) { if (row[x] == ' ' && !(a[x] & REC_A_NOSTAR)) row[x] = star; });
+    for (int x=0;x<WIDTH;x++) {
+      int step = a[x] & ~REC_A_NOSTAR;
+      if (step && expGradient) {
+        screenAttr.a[y][x] = expGradientAttr[min(step, EXPLOSION_FRAMES) - 1];
+        screenAttr.row[y] = true;
+      }
+    }
+  }
+  termFrame->tail = replay.tail;
+  if (status) {
+    if (colorOutput) termFrame->tail += COL_TEXT;
+    termFrame->tail += status;
+    if (colorOutput) termFrame->tail += COL_RESET;
+    termFrame->tail += '\n';
+  }
+  encodeScreen();
+}
+
+void replayRenderPosition() {
+  char line[160];
+  snprintf(line, sizeof(line), " REPLAY %ld:%02ld / %ld:%02ld%s   (Space pause, A/D seek 10s, Q quit)",
+           replay.tick * FRAME_MS / 60000, replay.tick * FRAME_MS / 1000 % 60,
+           replay.lastTick * FRAME_MS / 60000, replay.lastTick * FRAME_MS / 1000 % 60,
+           replay.pos >= replay.end ? " end" : replay.paused ? " paused" : "");
+  replayRender(line);
+}
+
+// decodes every frame to stdout as fast as possible, then times a few seeks
+int replayEmitAll() {
+  RecFrame f;
+  long frames = 0;
+  auto start = chrono::steady_clock::now();
+  replay.pos = replay.data + replay.keys[0].offset;
+  while (replayPeek(f)) {
+    if (!replayApply(f)) { cerr << "corrupt frame at byte " << (f.runs - replay.data) << "\n"; return 1; }
+    replayRender(nullptr);
+    swap(termShown, termFrame);
+    fwrite(frameBuf.data(), 1, frameBuf.size(), stdout);
+    bytesWrittenTotal += frameBuf.size();
+    frames++;
+  }
+  fflush(stdout);
+  double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  int64_t worst = 0;
+  for (int i=1; i<=8; i++) {
+    int64_t t0 = steadyNowNs();
+    replaySeek(replay.lastTick * i / 9);
+    worst = max(worst, steadyNowNs() - t0);
+  }
+  cerr << frames << " frames (" << replay.lastTick * FRAME_MS / 1000 << " s of play, " << replay.keys.size() << " keyframes), "
+       << (long)(frames / max(secs, 1e-9)) << " frames/s, " << bytesWrittenTotal << " bytes of "
+       << OUTPUT_MODE_NAMES[outputMode] << " frames, slowest seek " << worst / 1000 << " us\n";
+  return 0;
+}
+
+// collects tick and world hash of every frame in path that logs one
+bool replayHashes(const string &path, vector<pair<long, uint64_t>> &out) {
+  replay = Replay();
+  bool ok = replayOpen(path);
+  if (ok) {
+    RecFrame f;
+    replay.pos = replay.data + replay.keys[0].offset;
+    while (replayPeek(f)) {
+      if (f.flags & REC_F_HASH) out.push_back({f.tick, f.hash});
+      replay.tick = f.tick;
+      replay.scroll = f.scroll;
+      replay.pos = f.next;
+    }
+    if (out.empty()) { cerr << path << " logs no world hashes (recorded before version " << REC_VERSION << ")\n"; ok = false; }
+  }
+  replayUnmap();
+  return ok;
+}
+
+// --compare=A.tkr,B.tkr: finds the first tick both recordings logged with
+// different world hashes, i.e. where the two runs stopped being identical
+int compareRecordings(const string &a, const string &b) {
+  vector<pair<long, uint64_t>> ha, hb;
+  if (!replayHashes(a, ha) || !replayHashes(b, hb)) return 2;
+  size_t i = 0, j = 0;
+  long common = 0, lastSame = -1;
+  while (i < ha.size() && j < hb.size()) {
+    if (ha[i].first < hb[j].first) { i++; continue; }
+    if (hb[j].first < ha[i].first) { j++; continue; }
+    if (ha[i].second != hb[j].second) {
+      long t = ha[i].first;
+      char line[200];
+      snprintf(line, sizeof(line), "first divergence at tick %ld (%ld:%02ld): %016llx vs %016llx; last agreement at tick %ld\n",
+               t, t * FRAME_MS / 60000, t * FRAME_MS / 1000 % 60, (unsigned long long)ha[i].second,
+               (unsigned long long)hb[j].second, lastSame);
+      cout << line;
+      return 1;
+    }
+    lastSame = ha[i].first;
+    common++;
+    i++; j++;
+  }
+  cout << "identical: " << common << " ticks logged by both agree";
+  if (ha.size() != hb.size()) cout << " (" << a << " has " << ha.size() << ", " << b << " has " << hb.size() << ")";
+  cout << "\n";
+  return 0;
+}
+
+// terminal setup shared by the replay player and the viewer
+void watchBegin() {
+  enableVTAndUTF8();
+  kb_init();
+  loopInit();
+  if (outputMode == OUT_ANSI) cout << "\x1B[?25l";
+  outputBegin();
+}
+
+void watchEnd() {
+  outputEnd();
+  if (outputMode == OUT_ANSI) cout << "\x1B[?25h";
+  cout << "\x1B[2J\x1B[H" << flush;
+  loopClose();
+  kb_restore();
+  restoreConsole();
+}
+
+int runReplay(const string &path) {
+  if (!replayOpen(path)) { replayUnmap(); return 1; }
+  if (emitFrames) {
+    int rc = replayEmitAll();
+    replayUnmap();
+    return rc;
+  }
+  watchBegin();
+
+  replaySeek(replay.keys[0].tick);
+  replayRenderPosition();
+  outputSubmit(frameBuf, FRAME_NS);
+  int64_t baseNs = steadyNowNs();  // wall time at which baseTick shows
+  long baseTick = replay.tick;
+  bool playing = true;
+  while (playing) {
+    RecFrame f;
+    bool more = replayPeek(f);
+    int64_t due = more && !replay.paused ? baseNs + (f.tick - baseTick) * FRAME_NS : -1;
+    if (due < 0 || steadyNowNs() < due) loopWait(due);
+    bool redraw = false;
+    while (kb_hit()) {
+      int c = kb_get();
+      if (c >= 'A' && c <= 'Z') c += 32;
+      if (c == 'q') playing = false;
+      else if (c == ' ') { replay.paused = !replay.paused; redraw = true; }
+      else if (c == 'a' || c == 'd') {
+        replaySeek(max(0L, replay.tick + (c == 'a' ? -REC_KEY_TICKS : REC_KEY_TICKS)));
+        redraw = true;
+      }
+      baseNs = steadyNowNs();
+      baseTick = replay.tick;
+    }
+    if (more && !replay.paused && !redraw && steadyNowNs() >= due) redraw = replayApply(f);
+    if (redraw) {
+      replayRenderPosition();
+      outputSubmit(frameBuf, FRAME_NS);
+    }
+  }
+  watchEnd();
+  replayUnmap();
+  return 0;
+}
+
+// --view=NAME follows a game exporting with --shm=NAME, redrawing at most
+// once per tick from whatever frame is newest, until Q
+#if defined(_WIN32) || defined(_WIN64)
+int runViewer(const string &) {
+  cerr << "the viewer needs POSIX shared memory\n";
+  return 1;
+}
+#else
+// copies the newest complete frame into replay; false when it is still seq
+// or the game kept rewriting it while we copied
+bool viewerRead(const ShmFrame &f, uint32_t &seq) {
+  for (int tries=0; tries<100; tries++) {
+    uint32_t s1 = f.seq.load(memory_order_acquire);
+    if (s1 == seq) return false;
+    if (s1 & 1) { this_thread::yield(); continue; }
+    memcpy(replay.plane, f.plane, REC_PLANE);
+    replay.tail.assign(f.tail, min<uint32_t>(f.tailLen, SHM_TAIL_MAX));
+    replay.flags = f.flags;
+    replay.scroll = f.scroll;
+    replay.tick = (long)f.tick;
+    atomic_thread_fence(memory_order_acquire);
+    if (f.seq.load(memory_order_relaxed) == s1) { seq = s1; return true; }
+  }
+  return false;
+}
+
+int runViewer(const string &name) {
+  string path = shmPath(name);
+  int fd = shm_open(path.c_str(), O_RDONLY, 0);
+  if (fd < 0) { cerr << "nothing is exported as " << path << " (start a game with --shm=" << name << ")\n"; return 1; }
+  struct stat st;
+  void *p = fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ShmFrame)
+    ? mmap(nullptr, sizeof(ShmFrame), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  const ShmFrame *f = p == MAP_FAILED ? nullptr : (const ShmFrame*)p;
+  if (!f || memcmp(f->magic, "TKSH", 4) != 0 || f->version != SHM_VERSION || f->width != WIDTH || f->height != HEIGHT) {
+    cerr << path << " is not a frame export from this version\n";
+    if (f) munmap(p, sizeof(ShmFrame));
+    return 1;
+  }
+  watchBegin();
+  uint32_t seq = 1;  // odd: matches no published frame
+  bool wasLive = true, playing = true;
+  int64_t next = steadyNowNs();
+  while (playing) {
+    loopWait(next);
+    while (kb_hit()) {
+      int c = kb_get();
+      if (c == 'q' || c == 'Q') playing = false;
+    }
+    int64_t now = steadyNowNs();
+    if (now < next) continue;
+    next = max(next + FRAME_NS, now);
+    bool live = f->live.load(memory_order_acquire) != 0;
+    if (!viewerRead(*f, seq) && live == wasLive) continue;
+    wasLive = live;
+    char line[160];
+    snprintf(line, sizeof(line), " VIEW %s  tick %ld%s   (Q quit)", path.c_str(), replay.tick, live ? "" : "  game ended");
+    replayRender(line);
+    outputSubmit(frameBuf, FRAME_NS);
+  }
+  watchEnd();
+  munmap(p, sizeof(ShmFrame));
+  return 0;
+}
+#endif
+
+// ---------- Main ----------
+void printUsage(const char *prog) {
+  cout << "Usage: " << prog << " [options]\n"
+       << "  --profile      show the frame profiler overlay and dump a histogram on exit\n"
+       << "  --trace=FILE   record a Chrome/Perfetto trace of the game loop to FILE\n"
+       << "  --headless=N   run N ticks with the built-in bot and no terminal output\n"
+       << "  --alloc-check  with --headless, fail if any tick allocates after warm-up\n"
+       << "  --perf-counters  sample cycles/instructions/cache and branch misses per phase\n"
+       << "  --metrics=PATH serve Prometheus metrics on the Unix socket PATH\n"
+       << "  --fps=N        cap rendering at N frames per second (simulation stays at 25 Hz)\n"
+       << "  --no-adapt     keep full detail even when the terminal cannot keep up\n"
+       << "  --no-stars     turn off the scrolling starfield\n"
+       << "  --half-block   draw the arena with half-block pixels (needs a UTF-8 terminal)\n"
+       << "  --colors=N     arena colors: 16, 256 or truecolor (default: detected from TERM/COLORTERM)\n"
+       << "  --out=MODE     frame encoding: ansi, plain or binary (default: plain unless stdout is a terminal)\n"
+       << "  --emit-frames  with --headless or --play, write the frames to stdout\n"
+       << "  --record=FILE  save the session as an asciicast v2 recording, or as cell deltas if FILE ends in .tkr\n"
+       << "  --play=FILE    replay a .tkr recording (with --emit-frames: decode it all to stdout)\n"
+       << "  --compare=A,B  report the first tick where two .tkr recordings' world states differ\n"
+       << "  --seed=N       seed the game's random numbers, so runs with the same input repeat exactly\n"
+       << "  --threads=N    worker threads beside the main thread (default: one per extra core)\n"
+       << "  --batch=N      play N bot games of --headless ticks in parallel, seeds --seed onwards;\n"
+       << "                 --metrics reports each game's progress, --trace covers every thread\n"
+       << "  --shm=NAME     publish each frame to the shared-memory segment NAME for --view\n"
+       << "  --view=NAME    watch a game running with --shm=NAME\n"
+       << "  --spectate=ADDR  stream the game to spectators on Unix socket ADDR or tcp:PORT (localhost)\n"
+       << "  --host=ADDR    wait on ADDR (as for --spectate) for a second player, then play together\n"
+       << "  --join=ADDR    join the game hosted on ADDR\n"
+       << "  --versus       with --host, tanks can shoot each other and the last one standing wins\n"
+       << "  --swarm        swarm difficulty: thousands of enemies, their AI split across the worker threads\n"
+       << "  --input-delay=N  with --host, ticks between a key press and its effect (default 3)\n"
+       << "  --encoder=NAME frame encoder: scalar, sse2 (default) or avx2\n"
+       << "  --bench-encode[=N]  time each frame encoder over N bot-played frames\n"
+       << "  --help         show this help\n";
+}
+
+int main(int argc, char **argv) {
+  long headlessTicks = 0;
+  bool allocCheck = false;
+  int benchFrames = 0;
+  string encoderName, colorsName, outName, playPath, viewName, comparePaths;
+  long seed = -1;
+  int batchRuns = 0;
+  int threads = (int)thread::hardware_concurrency() - 1;  // the main thread works too
+  for (int i=1;i<argc;i++) {
+    string a = argv[i];
+    if (a == "--profile") { profOverlay = true; profDumpOnExit = true; }
+    else if (a.rfind("--trace=", 0) == 0 && a.size() > 8) { traceEnabled = true; tracePath = a.substr(8); }
+    else if (a.rfind("--headless=", 0) == 0) headlessTicks = atol(a.c_str() + 11);
+    else if (a == "--alloc-check") allocCheck = true;
+    else if (a == "--perf-counters") hwEnabled = true;
+    else if (a.rfind("--metrics=", 0) == 0 && a.size() > 10) metricsPath = a.substr(10);
+    else if (a.rfind("--fps=", 0) == 0) renderFpsCap = max(0, atoi(a.c_str() + 6));
+    else if (a == "--no-adapt") adaptiveDetail = false;
+    else if (a == "--no-stars") starsEnabled = false;
+    else if (a == "--half-block") halfBlocks = true;
+    else if (a.rfind("--colors=", 0) == 0) colorsName = a.substr(9);
+    else if (a.rfind("--out=", 0) == 0) outName = a.substr(6);
+    else if (a == "--emit-frames") emitFrames = true;
+    else if (a.rfind("--record=", 0) == 0 && a.size() > 9) recordPath = a.substr(9);
+    else if (a.rfind("--play=", 0) == 0 && a.size() > 7) playPath = a.substr(7);
+    else if (a.rfind("--compare=", 0) == 0 && a.find(',') != string::npos) comparePaths = a.substr(10);
+    else if (a.rfind("--seed=", 0) == 0) seed = max(0L, atol(a.c_str() + 7));
+    else if (a.rfind("--threads=", 0) == 0) threads = atoi(a.c_str() + 10);
+    else if (a.rfind("--batch=", 0) == 0) batchRuns = max(1, atoi(a.c_str() + 8));
+    else if (a.rfind("--shm=", 0) == 0 && a.size() > 6) shmName = a.substr(6);
+    else if (a.rfind("--view=", 0) == 0 && a.size() > 7) viewName = a.substr(7);
+    else if (a.rfind("--spectate=", 0) == 0 && a.size() > 11) spectatePath = a.substr(11);
+    else if (a.rfind("--host=", 0) == 0 && a.size() > 7) { lockAddr = a.substr(7); lockHost = true; }
+    else if (a.rfind("--join=", 0) == 0 && a.size() > 7) { lockAddr = a.substr(7); lockHost = false; }
+    else if (a == "--versus") versus = true;
+    else if (a == "--swarm") swarm = true;
+    else if (a.rfind("--input-delay=", 0) == 0) lockDelay = max(1, min(LOCK_MAX_DELAY, atoi(a.c_str() + 14)));
+    else if (a.rfind("--encoder=", 0) == 0) encoderName = a.substr(10);
+    else if (a == "--bench-encode") benchFrames = 2000;
+    else if (a.rfind("--bench-encode=", 0) == 0) benchFrames = max(1, atoi(a.c_str() + 15));
+    else { printUsage(argv[0]); return a == "--help" ? 0 : 1; }
+  }
+
+  seedRng(seed >= 0 ? (uint64_t)seed : (uint64_t)time(nullptr));
+  poolStart(threads);
+  atexit(poolStop);  // before the thread objects are destroyed
+  traceStartNs = profNowNs();
+  colorDepth = detectColorDepth();
+  if (!colorsName.empty()) {
+    int d = 0;
+    while (d < 3 && colorsName != COLOR_DEPTH_NAMES[d]) d++;
+    if (d == 3) { printUsage(argv[0]); return 1; }
+    colorDepth = (ColorDepth)d;
+  }
+  // headless frames only reach stdout with --emit-frames; otherwise they are
+  // for the recorder, which wants what a terminal would get
+  outputMode = headlessTicks > 0 && !emitFrames ? OUT_ANSI : detectOutputMode();
+  if (!outName.empty()) {
+    int m = 0;
+    while (m < 3 && outName != OUTPUT_MODE_NAMES[m]) m++;
+    if (m == 3) { printUsage(argv[0]); return 1; }
+    outputMode = (OutputMode)m;
+  }
+#if defined(_WIN32) || defined(_WIN64)
+  if (outputMode == OUT_BINARY) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  if (outputMode != OUT_ANSI) {
+    starsEnabled = false;  // a moving backdrop would change every row
+    cout.rdbuf(new StripEscBuf(cout.rdbuf()));  // never freed: cout flushes through it at exit
+  }
+  initCellColors();
+  initStars();
+  if (!selectRunEncoder(encoderName)) {
+    cerr << "encoder '" << encoderName << "' is not available on this CPU\n";
+    return 1;
+  }
+  if (benchFrames > 0) return benchEncode(benchFrames);
+  if (!playPath.empty()) return runReplay(playPath);
+  if (!comparePaths.empty()) {
+    size_t comma = comparePaths.find(',');
+    return compareRecordings(comparePaths.substr(0, comma), comparePaths.substr(comma + 1));
+  }
+  if (!viewName.empty()) return runViewer(viewName);
+  if (batchRuns > 0 && (!recordPath.empty() || !shmName.empty() || !spectatePath.empty() || !lockAddr.empty() || emitFrames)) {
+    cerr << "--batch plays many games at once; --record, --shm, --spectate, --host, --join and --emit-frames follow a single game\n";
+    return 1;
+  }
+  if (hwEnabled) {
+    hwEnabled = hwInit();
+    profDumpOnExit = true;
+  }
+  if (!metricsPath.empty() && metricsOpen()) rateStartNs = profNowNs();
+  if (batchRuns > 0) {
+    int rc = runBatch(batchRuns, headlessTicks > 0 ? headlessTicks : 10000, rngState);
+    metricsClose();
+    dumpPool(cerr);  // batch games draw no frames: this is all --profile would add
+    if (traceEnabled && !writeTrace(tracePath)) cerr << "could not write trace to " << tracePath << "\n";
+    return rc;
+  }
+  if (allocCheck && headlessTicks <= 0) headlessTicks = ALLOC_WARMUP_TICKS + 5000;
+  if (!recordPath.empty()) {
+    if (recordPath.size() > 4 && recordPath.compare(recordPath.size() - 4, 4, ".tkr") == 0) recFormat = REC_CELLS;
+    if (recFormat == REC_CAST && outputMode == OUT_BINARY) { cerr << "--record needs text frames, not --out=binary\n"; return 1; }
+    recWait = headlessTicks > 0;
+    if (!recordOpen()) { cerr << "could not open " << recordPath << " for recording\n"; return 1; }
+  }
+  if (!shmName.empty()) shmOpen();
+  if (!spectatePath.empty()) spectateOpen();
+  if (!lockAddr.empty() && !lockstepOpen()) return 1;
+  if (headlessTicks > 0) {
+    int rc = runHeadless(headlessTicks, allocCheck);
+    lockstepClose();
+    recordClose();
+    shmClose();
+    spectateClose();
+    metricsClose();
+    if (profDumpOnExit) dumpProfile(cerr);
+    if (traceEnabled && !writeTrace(tracePath)) cerr << "could not write trace to " << tracePath << "\n";
+    return rc;
+  }
+  enableVTAndUTF8();
+  kb_init();
+  loopInit();
+
+  while (!lockstep) {
     showTitleScreen();
-    while (!kb_hit()) this_thread::sleep_for(chrono::milliseconds(50));
-    int opt = kb_get();
+    int opt = waitKey();
     if (opt == '1') runGameLoop();
     else if (opt == '2') showInstructions();
     else if (opt == '3') showInfoScreen();
     else break;
   }
+  if (lockstep) runGameLoop();  // straight into the one shared game
+  lockstepClose();
 
+  metricsClose();
+  loopClose();
   kb_restore();
   restoreConsole();
   cout << colorReset() << "\nGoodbye!\n";
+  recordClose();
+  shmClose();
+  spectateClose();
+  if (profDumpOnExit) dumpProfile(cerr);
+  if (traceEnabled && !writeTrace(tracePath)) cerr << "could not write trace to " << tracePath << "\n";
   return 0;
 }
 